@@ -6,6 +6,26 @@
 #include <tk1_mem.h>
 #include <types.h>
 
+// clang-format off
+static volatile uint32_t *can_rx =          (volatile uint32_t *)TK1_MMIO_UART_RX_STATUS;
+static volatile uint32_t *rx =              (volatile uint32_t *)TK1_MMIO_UART_RX_DATA;
+static volatile uint32_t *uart_bit_rate =   (volatile uint32_t *)TK1_MMIO_UART_BIT_RATE;
+static volatile uint32_t *timer_ctrl =      (volatile uint32_t *)TK1_MMIO_TIMER_CTRL;
+static volatile uint32_t *timer_status =    (volatile uint32_t *)TK1_MMIO_TIMER_STATUS;
+static volatile uint32_t *timer_prescaler = (volatile uint32_t *)TK1_MMIO_TIMER_PRESCALER;
+static volatile uint32_t *timer =           (volatile uint32_t *)TK1_MMIO_TIMER_TIMER;
+// clang-format on
+
+// A byte on the line is a start bit, 8 data bits and a stop bit.
+#define UART_BITS_PER_BYTE 10
+
+// drain_rx() considers the line quiet once no byte arrived for this
+// many byte times, at whatever speed the UART runs. Far longer than a
+// gap within a frame, and well short of how long the client waits for
+// quiet before its next command (deviceDrainIdleByteTimes in
+// tkeyoath/resync.go must match).
+#define DRAIN_IDLE_BYTE_TIMES 64
+
 // Send reply frame with response status Not OK (NOK==1), shortest length
 void appreply_nok(struct frame_header hdr)
 {
@@ -13,8 +33,11 @@ void appreply_nok(struct frame_header hdr)
 	writebyte(0);
 }
 
-// Send app reply with frame header, response code, and LEN_X-1 bytes from buf
-void appreply(struct frame_header hdr, enum appcmd rspcode, void *buf)
+// Send app reply with frame header, response code, and the first buflen
+// bytes of buf, in the smallest frame that fits them. The response
+// code sets the largest frame it may use.
+void appreply(struct frame_header hdr, enum appcmd rspcode, void *buf,
+	      size_t buflen)
 {
 	size_t nbytes;
 	enum cmdlen len;
@@ -24,23 +47,26 @@ void appreply(struct frame_header hdr, enum appcmd rspcode, void *buf)
 	case APP_RSP_GET_ENCRYPTEDTOC:
 	case APP_RSP_PUT_GETRECORD:
 	case APP_RSP_CALCULATE:
-		len = LEN_128;
+	case APP_RSP_MIGRATE_GETKEY:
+	case APP_RSP_MIGRATE_START:
+	case APP_RSP_REWRAP:
+	case APP_RSP_LOOKUP:
+	case APP_RSP_GET_FILTERED_LIST:
 		nbytes = 128;
 		break;
 
 	case APP_RSP_LOAD_TOC:
 	case APP_RSP_PUT:
-		len = LEN_4;
 		nbytes = 4;
 		break;
 
 	case APP_RSP_GET_NAMEVERSION:
-		len = LEN_32;
+	case APP_RSP_GET_MEMINFO:
+	case APP_RSP_RESET:
 		nbytes = 32;
 		break;
 
 	case APP_RSP_UNKNOWN_CMD:
-		len = LEN_1;
 		nbytes = 1;
 		break;
 
@@ -52,12 +78,65 @@ void appreply(struct frame_header hdr, enum appcmd rspcode, void *buf)
 		return;
 	}
 
+	// app protocol header is 1 byte response code
+	if (1 + buflen > nbytes) {
+		qemu_puts("appreply(): Reply too long for: ");
+		qemu_puthex(rspcode);
+		qemu_lf();
+
+		return;
+	}
+
+	if (1 + buflen <= 1) {
+		len = LEN_1;
+		nbytes = 1;
+	} else if (1 + buflen <= 4) {
+		len = LEN_4;
+		nbytes = 4;
+	} else if (1 + buflen <= 32) {
+		len = LEN_32;
+		nbytes = 32;
+	} else {
+		len = LEN_128;
+		nbytes = 128;
+	}
+
 	// Frame Protocol Header
 	writebyte(genhdr(hdr.id, hdr.endpoint, 0x0, len));
 
-	// app protocol header is 1 byte response code
 	writebyte(rspcode);
 	nbytes--;
 
+	// buf holds at least CMDLEN_MAXBYTES - 1 bytes, zeroed past buflen
 	write(buf, nbytes);
 }
+
+// Discard incoming bytes until the line has been quiet for a while, and
+// return how many were dropped. Used after a header that does not parse:
+// what follows is the rest of a frame we lost track of, not a header.
+int drain_rx(void)
+{
+	int dropped = 0;
+
+	// The UART's bit rate is in clock cycles per bit, so the timer
+	// counts bit times.
+	*timer_prescaler = *uart_bit_rate;
+
+	for (;;) {
+		*timer = DRAIN_IDLE_BYTE_TIMES * UART_BITS_PER_BYTE;
+		*timer_ctrl = 1 << TK1_MMIO_TIMER_CTRL_START_BIT;
+
+		while (!*can_rx
+		       && (*timer_status & (1 << TK1_MMIO_TIMER_STATUS_RUNNING_BIT))) {
+		}
+		if (!*can_rx) {
+			break;
+		}
+
+		(void)*rx;
+		dropped++;
+		*timer_ctrl = 1 << TK1_MMIO_TIMER_CTRL_STOP_BIT;
+	}
+
+	return dropped;
+}
@@ -32,6 +32,27 @@ enum appcmd {
 
 	APP_CMD_CALCULATE        = 0x0d,
 	APP_RSP_CALCULATE        = 0x0e,
+
+	APP_CMD_MIGRATE_GETKEY   = 0x0f,
+	APP_RSP_MIGRATE_GETKEY   = 0x10,
+
+	APP_CMD_MIGRATE_START    = 0x11,
+	APP_RSP_MIGRATE_START    = 0x12,
+
+	APP_CMD_REWRAP           = 0x13,
+	APP_RSP_REWRAP           = 0x14,
+
+	APP_CMD_LOOKUP           = 0x15,
+	APP_RSP_LOOKUP           = 0x16,
+
+	APP_CMD_GET_FILTERED_LIST = 0x17,
+	APP_RSP_GET_FILTERED_LIST = 0x18,
+
+	APP_CMD_GET_MEMINFO      = 0x19,
+	APP_RSP_GET_MEMINFO      = 0x1a,
+
+	APP_CMD_RESET            = 0x1b,
+	APP_RSP_RESET            = 0x1c,
 	/*
 	APP_CMD_VALIDATE         = 0x07,
 	APP_RSP_VALIDATE         = 0x08,
@@ -46,6 +67,8 @@ enum appcmd {
 // clang-format on
 
 void appreply_nok(struct frame_header hdr);
-void appreply(struct frame_header hdr, enum appcmd rspcode, void *buf);
+void appreply(struct frame_header hdr, enum appcmd rspcode, void *buf,
+	      size_t buflen);
+int drain_rx(void);
 
 #endif
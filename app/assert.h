@@ -6,8 +6,14 @@
 #ifndef ASSERT_H
 #define ASSERT_H
 
+#ifdef NODEBUG
+// Nothing prints the strings without debug output, so keep them out
+// of the binary.
+#define assert(expr) ((expr) ? (void)(0) : assert_fail("", "", __LINE__, ""))
+#else
 #define assert(expr)                                                           \
 	((expr) ? (void)(0) : assert_fail(#expr, __FILE__, __LINE__, __func__))
+#endif
 
 void assert_fail(const char *assertion, const char *file, unsigned int line,
 		 const char *function);
@@ -14,11 +14,23 @@
 
 #endif
 
+// Capacity profiles, selected at build time with -DCAPACITY_SMALL or
+// -DCAPACITY_LARGE (see CAPACITY in the Makefile). The client must be
+// built with the same profile.
+#if defined(CAPACITY_SMALL)
+#define TOC_DESCRIPTORS_MAXCOUNT 	16
+#define RECORD_NAME_MAXLEN 32
+#elif defined(CAPACITY_LARGE)
+#define TOC_DESCRIPTORS_MAXCOUNT 	64
+#define RECORD_NAME_MAXLEN 64
+#else
 #define TOC_DESCRIPTORS_MAXCOUNT 	32
+#define RECORD_NAME_MAXLEN 64
+#endif
+
 #define TOC_SETTING_TOUCH_NO		(0<<7)
 #define TOC_SETTING_TOUCH_YES		(1<<7)
 
-#define RECORD_NAME_MAXLEN 64
 #define RECORD_KEY_MAXLEN 66 // 64 + 2 for algo & digits
 
 #define XCHACHA20_NONCE_LEN 24
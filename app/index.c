@@ -0,0 +1,111 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "index.h"
+#include "helpers.h"
+
+static uint8_t descriptor_len(const toc_record_descriptor_t *d)
+{
+	return min(d->name_len, RECORD_NAME_MAXLEN);
+}
+
+static int name_cmp(const uint8_t *l, uint8_t l_len, const uint8_t *r,
+		    uint8_t r_len)
+{
+	int cmp = memcmp(l, r, min(l_len, r_len));
+
+	if (cmp != 0) {
+		return cmp;
+	}
+
+	return (int)l_len - (int)r_len;
+}
+
+static int slot_cmp(const decrypted_toc_t *toc, uint8_t l, uint8_t r)
+{
+	const toc_record_descriptor_t *dl = &toc->descriptors[l];
+	const toc_record_descriptor_t *dr = &toc->descriptors[r];
+
+	return name_cmp(dl->name, descriptor_len(dl), dr->name,
+			descriptor_len(dr));
+}
+
+// Insert a slot already present in the ToC. Insertion sort is plenty
+// for TOC_DESCRIPTORS_MAXCOUNT entries.
+void name_index_insert(name_index_t *idx, const decrypted_toc_t *toc,
+		       uint8_t slot)
+{
+	int pos = idx->count;
+
+	if (idx->count >= TOC_DESCRIPTORS_MAXCOUNT) {
+		return;
+	}
+
+	while (pos > 0 && slot_cmp(toc, idx->sorted[pos - 1], slot) > 0) {
+		idx->sorted[pos] = idx->sorted[pos - 1];
+		pos--;
+	}
+	idx->sorted[pos] = slot;
+	idx->count++;
+}
+
+void name_index_build(name_index_t *idx, const decrypted_toc_t *toc)
+{
+	idx->count = 0;
+
+	for (uint8_t slot = 0; slot < toc->header.descriptor_count; slot++) {
+		name_index_insert(idx, toc, slot);
+	}
+}
+
+// Position in the sorted slots of the first name not sorting before
+// name.
+static int lower_bound(const name_index_t *idx, const decrypted_toc_t *toc,
+		       const uint8_t *name, uint8_t name_len)
+{
+	int lo = 0;
+	int hi = idx->count;
+
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+		const toc_record_descriptor_t *d =
+		    &toc->descriptors[idx->sorted[mid]];
+
+		if (name_cmp(d->name, descriptor_len(d), name, name_len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+// Write to slots, in name order, the slots whose name is name or, with
+// INDEX_QUERY_PREFIX, starts with name. Returns how many were written.
+int name_index_lookup(const name_index_t *idx, const decrypted_toc_t *toc,
+		      const uint8_t *name, uint8_t name_len, uint8_t flags,
+		      uint8_t *slots)
+{
+	const int exact = (flags & INDEX_QUERY_PREFIX) == 0;
+	int n = 0;
+
+	name_len = min(name_len, RECORD_NAME_MAXLEN);
+
+	// The names equal to, or starting with, name follow each other
+	// from the first one not sorting before it
+	for (int i = lower_bound(idx, toc, name, name_len); i < idx->count;
+	     i++) {
+		const uint8_t slot = idx->sorted[i];
+		const toc_record_descriptor_t *d = &toc->descriptors[slot];
+
+		if (descriptor_len(d) < name_len ||
+		    memcmp(d->name, name, name_len) != 0 ||
+		    (exact && descriptor_len(d) != name_len)) {
+			break;
+		}
+		slots[n++] = slot;
+	}
+
+	return n;
+}
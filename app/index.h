@@ -0,0 +1,26 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <types.h>
+#include "definitions.h"
+
+#define INDEX_QUERY_PREFIX (1 << 0)
+
+// Index over the names of the loaded ToC: the slots sorted by name,
+// binary searched for exact and prefix lookups.
+typedef struct {
+	uint8_t count;
+	uint8_t sorted[TOC_DESCRIPTORS_MAXCOUNT];
+} name_index_t;
+
+void name_index_build(name_index_t *idx, const decrypted_toc_t *toc);
+void name_index_insert(name_index_t *idx, const decrypted_toc_t *toc,
+		       uint8_t slot);
+int name_index_lookup(const name_index_t *idx, const decrypted_toc_t *toc,
+		      const uint8_t *name, uint8_t name_len, uint8_t flags,
+		      uint8_t *slots);
+
+#endif
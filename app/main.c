@@ -10,6 +10,9 @@
 #include "assert.h"
 #include "system.h"
 #include "oath/oath.h"
+#include "migrate.h"
+#include "index.h"
+#include "stack.h"
 
 // clang-format off
 static volatile uint32_t *cdi =   (volatile uint32_t *)TK1_MMIO_TK1_CDI_FIRST;
@@ -20,9 +23,45 @@ static volatile uint32_t *trng_entropy = (volatile uint32_t *)TK1_MMIO_TRNG_ENTR
 
 // clang-format on
 
+// Everything sized by the capacity profile lives in statically placed
+// arenas rather than on the stack, so that RAM use is known at link
+// time and the stack only holds call frames, including monocypher's
+// and HMAC's contexts.
+#define APP_ARENA_MAXBYTES 8192
+
+static uint8_t cmd[CMDLEN_MAXBYTES];
+static uint8_t rsp[CMDLEN_MAXBYTES];
+static uint8_t oath_record_buf[MAX(oath_record_put_t, secure_oath_record_t)] __attribute__((aligned(8)));
+static uint8_t toc_buf[sizeof(decrypted_toc_t)] __attribute__((aligned(8)));
+// Name index over the loaded ToC, and the matches of a filtered list
+// being streamed
+static name_index_t name_index;
+static uint8_t filter_slots[TOC_DESCRIPTORS_MAXCOUNT];
+
+#define APP_ARENA_BYTES                                                        \
+	(sizeof(cmd) + sizeof(rsp) + sizeof(oath_record_buf) +                 \
+	 sizeof(toc_buf) + sizeof(name_index) + sizeof(filter_slots))
+
+_Static_assert(APP_ARENA_BYTES <= APP_ARENA_MAXBYTES,
+	       "capacity profile does not fit the arena budget");
+_Static_assert(TOC_DESCRIPTORS_MAXCOUNT <= 255,
+	       "descriptor_count is a uint8_t");
+_Static_assert(sizeof(oath_calculate_t) <= sizeof(oath_record_buf),
+	       "oath_record_buf holds calculate requests");
+_Static_assert(1 + sizeof(oath_calculate_t) <= CMDLEN_MAXBYTES,
+	       "a calculate request must fit one frame");
+_Static_assert(1 + 4 + sizeof(secure_oath_record_t) <= PAYLOAD_MAXLEN,
+	       "a calculate reply must fit one frame");
+_Static_assert(2 + TOC_DESCRIPTORS_MAXCOUNT <= PAYLOAD_MAXLEN,
+	       "a lookup reply must fit one frame");
+_Static_assert(3 + 2 + RECORD_NAME_MAXLEN <= PAYLOAD_MAXLEN,
+	       "a filtered list frame must fit at least one name");
+_Static_assert(3 + RECORD_NAME_MAXLEN <= CMDLEN_MAXBYTES,
+	       "a lookup query must fit one frame");
+
 const uint8_t app_name0[4] = "tk1 ";
 const uint8_t app_name1[4] = "oath";
-const uint32_t app_version = 0x00000001;
+const uint32_t app_version = 0x00000005;
 
 void get_random(uint8_t *buf, int bytes)
 {
@@ -47,20 +86,32 @@ int main(void)
 {
 	uint32_t stack;
 	struct frame_header hdr; // Used in both directions
-	uint8_t cmd[CMDLEN_MAXBYTES];
-	uint8_t rsp[CMDLEN_MAXBYTES];
 	uint8_t forced_next_command = APP_CMD_LOAD_TOC;
 
 	int32_t nbytes_transferred = 0;
 
 	uint8_t oath_record_buf_encrypted_b = 0;
-	uint8_t oath_record_buf[MAX(oath_record_put_t, secure_oath_record_t)];
-
-	uint8_t toc_buf[sizeof(decrypted_toc_t)];
-	memset(toc_buf, 0, sizeof(toc_buf));
+	uint8_t filter_count = 0;
+	uint8_t filter_pos = 0;
+	// Bytes discarded after headers that did not parse, since the
+	// last reset
+	uint32_t dropped_bytes = 0;
 
 	uint8_t in;
 	uint32_t local_cdi[8];
+	uint8_t app_digest[MIGRATE_DIGEST_LEN];
+
+	// Keys opening incoming, and sealing outgoing, ToCs and records.
+	// Both are the CDI, except during a migration, which ends once
+	// the ToC has been sent, or on reset.
+	uint8_t transport_key[MIGRATE_KEY_LEN];
+	const uint8_t *unseal_key = (const uint8_t *)local_cdi;
+	const uint8_t *seal_key = (const uint8_t *)local_cdi;
+
+	// Before anything writes to .data, which is part of the binary
+	migrate_measure(app_digest);
+
+	stack_paint();
 
 	qemu_puts("Hello! &stack is on: ");
 	qemu_putinthex((uint32_t)&stack);
@@ -78,7 +129,12 @@ int main(void)
 		qemu_lf();
 
 		if (parseframe(in, &hdr) == -1) {
-			qemu_puts("Couldn't parse header\n");
+			// We lost track of the frames: drop the rest of
+			// this burst rather than parse it a byte at a time
+			dropped_bytes += 1 + drain_rx();
+			qemu_puts("Couldn't parse header, dropped: ");
+			qemu_putinthex(dropped_bytes);
+			qemu_lf();
 			continue;
 		}
 
@@ -104,7 +160,9 @@ int main(void)
 		// Reset response buffer
 		memset(rsp, 0, CMDLEN_MAXBYTES);
 
-		if ((forced_next_command != 0) && (cmd[0] != forced_next_command) && (cmd[0] != APP_CMD_GET_NAMEVERSION)) {
+		if ((forced_next_command != 0) && (cmd[0] != forced_next_command) && (cmd[0] != APP_CMD_GET_NAMEVERSION)
+			&& (cmd[0] != APP_CMD_GET_MEMINFO) && (cmd[0] != APP_CMD_MIGRATE_GETKEY) && (cmd[0] != APP_CMD_MIGRATE_START)
+			&& (cmd[0] != APP_CMD_RESET)) {
 			set_led(LED_RED|LED_BLUE);
 			appreply_nok(hdr);
 			qemu_puts("Responded NOK as message was not expected\n");
@@ -121,7 +179,7 @@ int main(void)
 				memcpy(rsp + 4, app_name1, 4);
 				memcpy(rsp + 8, &app_version, 4);
 			}
-			appreply(hdr, APP_RSP_GET_NAMEVERSION, rsp);
+			appreply(hdr, APP_RSP_GET_NAMEVERSION, rsp, 12);
 			break;
 
 		case APP_CMD_LOAD_TOC: {
@@ -129,6 +187,7 @@ int main(void)
 
 			const int skipfirst = nbytes_transferred == 0;
 			if (skipfirst) {
+				name_index.count = 0;
 				memset(&toc_buf[0], 0, sizeof(toc_buf));
 				memcpy(&toc_buf[0], &cmd[1], sizeof(decrypted_toc_header_t));
 			}
@@ -137,14 +196,16 @@ int main(void)
 
 			if (header->descriptor_count > TOC_DESCRIPTORS_MAXCOUNT) {
 				set_led(LED_RED);
+				nbytes_transferred = 0;
+				forced_next_command = APP_CMD_LOAD_TOC;
 				rsp[0] = STATUS_BAD;
-				appreply(hdr, APP_RSP_LOAD_TOC, rsp);
+				appreply(hdr, APP_RSP_LOAD_TOC, rsp, 1);
 				break;
 			}
 			else if (header->descriptor_count == 0) {
 				set_led(LED_GREEN);
 				rsp[0] = STATUS_OK;
-				appreply(hdr, APP_RSP_LOAD_TOC, rsp);
+				appreply(hdr, APP_RSP_LOAD_TOC, rsp, 1);
 				forced_next_command = 0;
 				break;
 			}
@@ -161,7 +222,7 @@ int main(void)
 				const uint8_t* protected_header_str = (uint8_t*)&toc->header.protected_header;
 
 				int mismatch = crypto_unlock_aead(
-					(uint8_t*)toc->descriptors, (const uint8_t *)local_cdi, 
+					(uint8_t*)toc->descriptors, unseal_key,
 					header->nonce, header->mac, 
 					protected_header_str, sizeof(toc_header_protected_t),
 					(uint8_t*)toc->descriptors, header->descriptor_count*sizeof(toc_record_descriptor_t));
@@ -169,11 +230,15 @@ int main(void)
 				if (mismatch < 0) {
 					qemu_puts("Failed decrypting record\n");
 					set_led(LED_RED|LED_GREEN);
+					crypto_wipe(toc_buf, sizeof(toc_buf));
+					nbytes_transferred = 0;
+					forced_next_command = APP_CMD_LOAD_TOC;
 					rsp[0] = STATUS_BAD;
-					appreply(hdr, APP_RSP_LOAD_TOC, rsp);
+					appreply(hdr, APP_RSP_LOAD_TOC, rsp, 1);
 					break;
 				}
 
+				name_index_build(&name_index, toc);
 				nbytes_transferred = 0;
 				forced_next_command = 0;
 			}
@@ -182,7 +247,7 @@ int main(void)
 			}
 
 			rsp[0] = STATUS_OK;
-			appreply(hdr, APP_RSP_LOAD_TOC, rsp);
+			appreply(hdr, APP_RSP_LOAD_TOC, rsp, 1);
 
 			break;
 		}
@@ -220,7 +285,7 @@ int main(void)
 				forced_next_command = APP_CMD_GET_LIST;
 			}
 
-			appreply(hdr, APP_RSP_GET_LIST, rsp);
+			appreply(hdr, APP_RSP_GET_LIST, rsp, 1 + nbytes);
 
 			break;
 		}
@@ -235,12 +300,15 @@ int main(void)
 			if (toc->header.descriptor_count == 0) {
 				set_led(LED_RED);
 				rsp[0] = STATUS_BAD;
-				appreply(hdr, APP_RSP_GET_ENCRYPTEDTOC, rsp);
+				appreply(hdr, APP_RSP_GET_ENCRYPTEDTOC, rsp, 1);
 				break;
 			}
 
 			const int isfirst = nbytes_transferred == 0;
 			if (isfirst) {
+				// the descriptors are encrypted in place below
+				name_index.count = 0;
+
 				// may have been mutated - let's get a new nonce
 				get_random(toc->header.nonce, XCHACHA20_NONCE_LEN);
 
@@ -249,7 +317,7 @@ int main(void)
 				// encrypt it
 				crypto_lock_aead(
 					toc->header.mac, (uint8_t*)toc->descriptors,
-					(const uint8_t *)local_cdi, toc->header.nonce,
+					seal_key, toc->header.nonce,
 					protected_header_str, sizeof(toc_header_protected_t),
 					(uint8_t*)toc->descriptors, blob_len);
 			}
@@ -269,13 +337,19 @@ int main(void)
 				set_led(LED_BLUE | LED_RED);
 				nbytes_transferred = 0;
 				forced_next_command = APP_CMD_LOAD_TOC;
+
+				// The ToC goes last in a migration: end it, so
+				// that what follows is sealed with the CDI again
+				crypto_wipe(transport_key, sizeof(transport_key));
+				unseal_key = (const uint8_t *)local_cdi;
+				seal_key = (const uint8_t *)local_cdi;
 			}
 			else {
 				forced_next_command = APP_CMD_GET_ENCRYPTEDTOC;
 			}
 
 			rsp[0] = STATUS_OK;
-			appreply(hdr, APP_RSP_GET_ENCRYPTEDTOC, rsp);
+			appreply(hdr, APP_RSP_GET_ENCRYPTEDTOC, rsp, 1 + nbytes);
 
 			break;
 		}
@@ -284,9 +358,12 @@ int main(void)
 			qemu_puts("APP_CMD_PUT\n");
 			set_led(LED_BLUE);
 			decrypted_toc_t* toc = (decrypted_toc_t*)toc_buf;
-			if ((toc->header.descriptor_count + 1) > TOC_DESCRIPTORS_MAXCOUNT) {
+			// Records are sealed with the CDI, which a ToC being
+			// migrated is not
+			if (((toc->header.descriptor_count + 1) > TOC_DESCRIPTORS_MAXCOUNT)
+				|| (seal_key != unseal_key)) {
 				rsp[0] = STATUS_BAD;
-				appreply(hdr, APP_RSP_PUT, rsp);
+				appreply(hdr, APP_RSP_PUT, rsp, 1);
 				break;
 			}
 
@@ -301,16 +378,30 @@ int main(void)
 
 			// done receiving the new record
 			if (nbytes_transferred == sizeof(oath_record_put_t)) {
-				set_led(LED_GREEN);
 				nbytes_transferred = 0;
 
 				oath_record_put_t *new_record = (oath_record_put_t*)oath_record_buf;
+				const oath_record_secret_t *new_secret =
+					(const oath_record_secret_t*)new_record->record.encrypted_blob;
+
+				// e.g. the last frame completed by resync filler
+				if ((new_record->name_len > RECORD_NAME_MAXLEN)
+					|| (new_secret->key_len > RECORD_KEY_MAXLEN)) {
+					crypto_wipe(oath_record_buf, sizeof(oath_record_buf));
+					forced_next_command = 0;
+					set_led(LED_RED);
+					rsp[0] = STATUS_BAD;
+					appreply(hdr, APP_RSP_PUT, rsp, 1);
+					break;
+				}
+				set_led(LED_GREEN);
 
 				// add it to the ToC
 				toc_record_descriptor_t *new_descriptor = &toc->descriptors[toc->header.descriptor_count];
 				new_descriptor->name_len = new_record->name_len;
 				memcpy(new_descriptor->name, new_record->name, new_record->name_len);
 				toc->header.descriptor_count += 1;
+				name_index_insert(&name_index, toc, toc->header.descriptor_count - 1);
 				memset(new_record->name, 0, RECORD_NAME_MAXLEN);
 				
 				// encrypt the record straight away
@@ -336,7 +427,7 @@ int main(void)
 			}
 
 			rsp[0] = STATUS_OK;
-			appreply(hdr, APP_RSP_PUT, rsp);
+			appreply(hdr, APP_RSP_PUT, rsp, 1);
 
 			break;
 		}
@@ -348,7 +439,7 @@ int main(void)
 			if (oath_record_buf_encrypted_b == 0) {
 				set_led(LED_RED);
 				rsp[0] = STATUS_BAD;
-				appreply(hdr, APP_RSP_PUT_GETRECORD, rsp);
+				appreply(hdr, APP_RSP_PUT_GETRECORD, rsp, 1);
 				break;
 			}
 			
@@ -361,7 +452,7 @@ int main(void)
 			forced_next_command = 0;
 
 			rsp[0] = STATUS_OK;
-			appreply(hdr, APP_RSP_PUT_GETRECORD, rsp);
+			appreply(hdr, APP_RSP_PUT_GETRECORD, rsp, 1 + nbytes);
 			
 			break;
 		}
@@ -390,7 +481,18 @@ int main(void)
 				qemu_puts("Failed decrypting record\n");
 				set_led(LED_RED);
 				rsp[0] = STATUS_BAD;
-				appreply(hdr, APP_RSP_CALCULATE, rsp);
+				appreply(hdr, APP_RSP_CALCULATE, rsp, 1);
+				break;
+			}
+
+			oath_record_secret_t *decrypted_record = (oath_record_secret_t*)oath_record_buf;
+
+			// sealed by a PUT that did not check it
+			if (decrypted_record->key_len > RECORD_KEY_MAXLEN) {
+				crypto_wipe(oath_record_buf, sizeof(oath_record_buf));
+				set_led(LED_RED);
+				rsp[0] = STATUS_BAD;
+				appreply(hdr, APP_RSP_CALCULATE, rsp, 1);
 				break;
 			}
 
@@ -398,7 +500,6 @@ int main(void)
 				wait_touch_ledflash(LED_GREEN, 35000);
 			}
 
-			oath_record_secret_t *decrypted_record = (oath_record_secret_t*)oath_record_buf;
 			oath_record_protected_t *metadata = &secure_record->record.protected;
 			uint64_t seq;
 			if (metadata->properties & OATH_PROP_TYPE_HOTP) {
@@ -412,6 +513,7 @@ int main(void)
 			}
 
 			uint32_t response = oath_hotp(decrypted_record->key, decrypted_record->key_len, seq, metadata->digits);
+			size_t rsp_len = 1 + sizeof(response);
 			rsp[1] = response;
 			rsp[2] = response >> 8;
 			rsp[3] = response >> 16;
@@ -437,13 +539,332 @@ int main(void)
 				assert(1 + sizeof(response) + nbytes <= sizeof(rsp));
 				assert(nbytes <= sizeof(oath_record_buf));
 				memcpy(&rsp[1+sizeof(response)], &oath_record_buf[0], nbytes);
+				rsp_len += nbytes;
 			}
 
 			rsp[0] = STATUS_OK;
-			appreply(hdr, APP_RSP_CALCULATE, rsp);
+			appreply(hdr, APP_RSP_CALCULATE, rsp, rsp_len);
 			
 			break;
 		}
+		case APP_CMD_LOOKUP: {
+			qemu_puts("APP_CMD_LOOKUP\n");
+
+			decrypted_toc_t* toc = (decrypted_toc_t*)toc_buf;
+
+			if (toc->header.protected_header.settings & TOC_SETTING_TOUCH_YES) {
+				wait_touch_ledflash(LED_GREEN, 35000);
+			}
+			set_led(LED_GREEN);
+
+			// cmd: flags, name_len, name; rsp: status, count, slots
+			const int count = name_index_lookup(&name_index, toc,
+				&cmd[3], cmd[2], cmd[1], &rsp[2]);
+			assert(2 + count <= sizeof(rsp));
+
+			rsp[0] = STATUS_OK;
+			rsp[1] = count;
+			appreply(hdr, APP_RSP_LOOKUP, rsp, 2 + count);
+
+			break;
+		}
+
+		case APP_CMD_GET_FILTERED_LIST: {
+			qemu_puts("APP_CMD_GET_FILTERED_LIST\n");
+
+			decrypted_toc_t* toc = (decrypted_toc_t*)toc_buf;
+
+			// The first frame carries the query, like APP_CMD_LOOKUP
+			if (forced_next_command != APP_CMD_GET_FILTERED_LIST) {
+				if (toc->header.protected_header.settings & TOC_SETTING_TOUCH_YES) {
+					wait_touch_ledflash(LED_GREEN, 35000);
+				}
+				set_led(LED_GREEN);
+
+				filter_count = name_index_lookup(&name_index, toc,
+					&cmd[3], cmd[2], cmd[1], filter_slots);
+				filter_pos = 0;
+			}
+
+			// rsp: status, entries in this frame, entries left
+			// after it, then (slot, name_len, name) per entry
+			int off = 3;
+			uint8_t entries = 0;
+			while (filter_pos < filter_count) {
+				const uint8_t slot = filter_slots[filter_pos];
+				const toc_record_descriptor_t *d = &toc->descriptors[slot];
+				const uint8_t len = min(d->name_len, RECORD_NAME_MAXLEN);
+
+				if (off + 2 + len > PAYLOAD_MAXLEN) {
+					break;
+				}
+				rsp[off] = slot;
+				rsp[off + 1] = len;
+				memcpy(&rsp[off + 2], d->name, len);
+				off += 2 + len;
+				entries++;
+				filter_pos++;
+			}
+
+			if (filter_pos == filter_count) {
+				forced_next_command = 0;
+			}
+			else {
+				forced_next_command = APP_CMD_GET_FILTERED_LIST;
+			}
+
+			rsp[0] = STATUS_OK;
+			rsp[1] = entries;
+			rsp[2] = filter_count - filter_pos;
+			appreply(hdr, APP_RSP_GET_FILTERED_LIST, rsp, off);
+
+			break;
+		}
+
+		case APP_CMD_GET_MEMINFO: {
+			qemu_puts("APP_CMD_GET_MEMINFO\n");
+
+			// rsp: status, stack size, stack high-water mark and
+			// arena size (LE uint32s), then the capacity profile
+			const uint32_t size = stack_size();
+			const uint32_t high_water = stack_high_water();
+			const uint32_t arena = APP_ARENA_BYTES;
+			memcpy(&rsp[1], &size, 4);
+			memcpy(&rsp[5], &high_water, 4);
+			memcpy(&rsp[9], &arena, 4);
+			rsp[13] = TOC_DESCRIPTORS_MAXCOUNT;
+			rsp[14] = RECORD_NAME_MAXLEN;
+
+			rsp[0] = STATUS_OK;
+			appreply(hdr, APP_RSP_GET_MEMINFO, rsp, 15);
+
+			break;
+		}
+
+		case APP_CMD_RESET: {
+			qemu_puts("APP_CMD_RESET\n");
+
+			// Abort whatever transfer a client left unfinished, and
+			// put the ToC back as it was before it started, if we
+			// can. A migration in progress is ended.
+			decrypted_toc_t* toc = (decrypted_toc_t*)toc_buf;
+			const uint8_t interrupted = forced_next_command;
+
+			switch (interrupted) {
+			case APP_CMD_GET_ENCRYPTEDTOC: {
+				// the descriptors were sealed in place: open them again
+				const uint8_t* protected_header_str = (uint8_t*)&toc->header.protected_header;
+
+				int mismatch = crypto_unlock_aead(
+					(uint8_t*)toc->descriptors, seal_key,
+					toc->header.nonce, toc->header.mac,
+					protected_header_str, sizeof(toc_header_protected_t),
+					(uint8_t*)toc->descriptors, toc->header.descriptor_count*sizeof(toc_record_descriptor_t));
+
+				if (mismatch < 0) {
+					forced_next_command = APP_CMD_LOAD_TOC;
+				}
+				else {
+					name_index_build(&name_index, toc);
+					forced_next_command = 0;
+				}
+				break;
+			}
+
+			case APP_CMD_PUT:
+				// nothing was added yet: the partial record is wiped
+				// below
+				forced_next_command = 0;
+				break;
+
+			case APP_CMD_PUT_GETRECORD:
+				// the client never got the sealed record, or resync
+				// filler completed the last frame of its PUT and the
+				// record is garbage: drop its descriptor either way
+				toc->header.descriptor_count -= 1;
+				memset(&toc->descriptors[toc->header.descriptor_count], 0,
+				       sizeof(toc_record_descriptor_t));
+				name_index_build(&name_index, toc);
+				forced_next_command = 0;
+				break;
+
+			case APP_CMD_LOAD_TOC:
+				// no ToC, or only part of one
+				break;
+
+			default:
+				forced_next_command = 0;
+				break;
+			}
+
+			if (forced_next_command == APP_CMD_LOAD_TOC) {
+				name_index.count = 0;
+				crypto_wipe(toc_buf, sizeof(toc_buf));
+			}
+
+			// the ToC was opened above with the migration keys, if
+			// any: what follows is sealed with the CDI
+			crypto_wipe(transport_key, sizeof(transport_key));
+			unseal_key = (const uint8_t *)local_cdi;
+			seal_key = (const uint8_t *)local_cdi;
+
+			// a partial PUT holds a plaintext secret
+			crypto_wipe(oath_record_buf, sizeof(oath_record_buf));
+			oath_record_buf_encrypted_b = 0;
+			nbytes_transferred = 0;
+			filter_count = 0;
+			filter_pos = 0;
+
+			// rsp: status, whether a ToC is loaded, the command
+			// that was interrupted (0 if none), bytes dropped since
+			// the last reset (LE uint32)
+			set_led(LED_BLUE);
+			rsp[0] = STATUS_OK;
+			rsp[1] = forced_next_command != APP_CMD_LOAD_TOC;
+			rsp[2] = interrupted;
+			memcpy(&rsp[3], &dropped_bytes, 4);
+			dropped_bytes = 0;
+			appreply(hdr, APP_RSP_RESET, rsp, 7);
+
+			break;
+		}
+
+		case APP_CMD_MIGRATE_GETKEY: {
+			qemu_puts("APP_CMD_MIGRATE_GETKEY\n");
+
+			// rsp: status, migration key, digest of this app
+			uint8_t secret[MIGRATE_KEY_LEN];
+			migrate_keypair(secret, &rsp[1], local_cdi);
+			crypto_wipe(secret, sizeof(secret));
+			memcpy(&rsp[1 + MIGRATE_KEY_LEN], app_digest, MIGRATE_DIGEST_LEN);
+
+			rsp[0] = STATUS_OK;
+			appreply(hdr, APP_RSP_MIGRATE_GETKEY, rsp,
+				 1 + MIGRATE_KEY_LEN + MIGRATE_DIGEST_LEN);
+
+			break;
+		}
+
+		case APP_CMD_MIGRATE_START: {
+			qemu_puts("APP_CMD_MIGRATE_START\n");
+
+			// Only between transfers, and not during another
+			// migration
+			if ((nbytes_transferred != 0) || (seal_key != unseal_key)) {
+				set_led(LED_RED);
+				rsp[0] = STATUS_BAD;
+				appreply(hdr, APP_RSP_MIGRATE_START, rsp, 1);
+				break;
+			}
+
+			// cmd: mode, peer key, then when exporting the
+			// digest of the target app
+			const uint8_t mode = cmd[1];
+			const uint8_t *peer_pub = &cmd[2];
+			const uint8_t *target_digest = &cmd[2 + MIGRATE_KEY_LEN];
+			uint8_t secret[MIGRATE_KEY_LEN];
+			uint8_t pub[MIGRATE_KEY_LEN];
+			size_t rsp_len = 1;
+			int err = -1;
+
+			if (mode == MIGRATE_MODE_EXPORT) {
+				// peer_pub is the target app's migration key. Seal
+				// for it with an ephemeral key, returned to the
+				// client to store with the migrated bundle. The
+				// key is checked before asking for the touch.
+				get_random(secret, MIGRATE_KEY_LEN);
+				crypto_x25519_public_key(pub, secret);
+				err = migrate_transport_key(transport_key, secret,
+							    peer_pub, pub, peer_pub,
+							    target_digest);
+				if (err == 0) {
+					// Exporting hands the secrets to whoever
+					// holds the target key: require two touches,
+					// asked for unlike any other.
+					wait_touch_ledalternate(LED_RED, LED_BLUE, 35000);
+					wait_touch_ledalternate(LED_BLUE, LED_RED, 35000);
+
+					memcpy(&rsp[1], pub, MIGRATE_KEY_LEN);
+					rsp_len += MIGRATE_KEY_LEN;
+					seal_key = transport_key;
+				}
+			} else if (mode == MIGRATE_MODE_IMPORT) {
+				// peer_pub is the ephemeral key of the export. A
+				// bundle exported for another binary than this
+				// one does not open.
+				migrate_keypair(secret, pub, local_cdi);
+				err = migrate_transport_key(transport_key, secret,
+							    peer_pub, peer_pub, pub,
+							    app_digest);
+				if (err == 0) {
+					unseal_key = transport_key;
+				}
+			}
+			crypto_wipe(secret, sizeof(secret));
+
+			if (err != 0) {
+				crypto_wipe(transport_key, sizeof(transport_key));
+				set_led(LED_RED);
+				rsp[0] = STATUS_BAD;
+				appreply(hdr, APP_RSP_MIGRATE_START, rsp, 1);
+				break;
+			}
+
+			set_led(LED_BLUE | LED_GREEN);
+			rsp[0] = STATUS_OK;
+			appreply(hdr, APP_RSP_MIGRATE_START, rsp, rsp_len);
+
+			break;
+		}
+
+		case APP_CMD_REWRAP: {
+			qemu_puts("APP_CMD_REWRAP\n");
+
+			// no migration started
+			if (seal_key == unseal_key) {
+				set_led(LED_RED);
+				rsp[0] = STATUS_BAD;
+				appreply(hdr, APP_RSP_REWRAP, rsp, 1);
+				break;
+			}
+
+			const int nbytes = sizeof(secure_oath_record_t);
+			assert(1 + nbytes <= sizeof(cmd));
+			assert(1 + nbytes <= sizeof(rsp));
+			assert(nbytes <= sizeof(oath_record_buf));
+			memcpy(&oath_record_buf[0], &cmd[1], nbytes);
+
+			secure_oath_record_t *secure_record = (secure_oath_record_t*)oath_record_buf;
+			const uint8_t* protected_metadata_str = (uint8_t*)&secure_record->record.protected;
+
+			int mismatch = crypto_unlock_aead(
+				secure_record->record.encrypted_blob, unseal_key,
+				secure_record->nonce, secure_record->mac,
+				protected_metadata_str, sizeof(oath_record_protected_t),
+				secure_record->record.encrypted_blob, sizeof(oath_record_secret_t));
+
+			if (mismatch < 0) {
+				qemu_puts("Failed decrypting record\n");
+				set_led(LED_RED);
+				rsp[0] = STATUS_BAD;
+				appreply(hdr, APP_RSP_REWRAP, rsp, 1);
+				break;
+			}
+
+			get_random(secure_record->nonce, XCHACHA20_NONCE_LEN);
+			crypto_lock_aead(
+				secure_record->mac, secure_record->record.encrypted_blob,
+				seal_key, secure_record->nonce,
+				protected_metadata_str, sizeof(oath_record_protected_t),
+				secure_record->record.encrypted_blob, sizeof(oath_record_secret_t));
+
+			memcpy(&rsp[1], &oath_record_buf[0], nbytes);
+
+			rsp[0] = STATUS_OK;
+			appreply(hdr, APP_RSP_REWRAP, rsp, 1 + nbytes);
+
+			break;
+		}
 		}
 	}
 }
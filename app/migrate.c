@@ -0,0 +1,69 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "migrate.h"
+#include <blake2s/blake2s.h>
+#include <lib.h>
+#include <monocypher/monocypher.h>
+#include <tk1_mem.h>
+
+static volatile uint32_t *app_addr = (volatile uint32_t *)TK1_MMIO_TK1_APP_ADDR;
+static volatile uint32_t *app_size = (volatile uint32_t *)TK1_MMIO_TK1_APP_SIZE;
+
+static const uint8_t migrate_context[] = "tk1 oath migrate";
+static const uint8_t no_shared_secret[MIGRATE_KEY_LEN] = {0};
+
+// The migration key pair of this app is derived from its CDI, so a
+// later version can publish its public key, and an earlier version
+// seal records that only this exact app binary can open.
+void migrate_keypair(uint8_t secret[MIGRATE_KEY_LEN],
+		     uint8_t pub[MIGRATE_KEY_LEN], const uint32_t cdi[8])
+{
+	crypto_blake2b_general(secret, MIGRATE_KEY_LEN, (const uint8_t *)cdi,
+			       32, migrate_context,
+			       sizeof(migrate_context) - 1);
+	crypto_x25519_public_key(pub, secret);
+}
+
+// The digest the firmware derived the CDI from: BLAKE2s over the app
+// binary as loaded. It only holds until something in .data is
+// written, so main() takes it first thing.
+void migrate_measure(uint8_t digest[MIGRATE_DIGEST_LEN])
+{
+	blake2s_ctx ctx;
+
+	blake2s(digest, MIGRATE_DIGEST_LEN, 0, 0, (const void *)*app_addr,
+		*app_size, &ctx);
+}
+
+// Both sides hash the X25519 shared secret with both public keys and
+// the digest of the target app, so the transport key is bound to this
+// exact exchange, and only opens in that app binary: the exporting app
+// takes the digest from the host, the importing app measures its own.
+// Returns -1 for a low-order public key, whose shared secret is zero
+// whatever our secret, so that anyone could derive the key.
+int migrate_transport_key(uint8_t key[MIGRATE_KEY_LEN],
+			  const uint8_t our_secret[MIGRATE_KEY_LEN],
+			  const uint8_t their_pub[MIGRATE_KEY_LEN],
+			  const uint8_t ephemeral_pub[MIGRATE_KEY_LEN],
+			  const uint8_t target_pub[MIGRATE_KEY_LEN],
+			  const uint8_t target_digest[MIGRATE_DIGEST_LEN])
+{
+	uint8_t material[3 * MIGRATE_KEY_LEN + MIGRATE_DIGEST_LEN];
+
+	crypto_x25519(material, our_secret, their_pub);
+	if (crypto_verify32(material, no_shared_secret) == 0) {
+		crypto_wipe(material, MIGRATE_KEY_LEN);
+		return -1;
+	}
+	memcpy(&material[MIGRATE_KEY_LEN], ephemeral_pub, MIGRATE_KEY_LEN);
+	memcpy(&material[2 * MIGRATE_KEY_LEN], target_pub, MIGRATE_KEY_LEN);
+	memcpy(&material[3 * MIGRATE_KEY_LEN], target_digest,
+	       MIGRATE_DIGEST_LEN);
+
+	crypto_blake2b_general(key, MIGRATE_KEY_LEN, 0, 0, material,
+			       sizeof(material));
+	crypto_wipe(material, sizeof(material));
+
+	return 0;
+}
@@ -0,0 +1,25 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <types.h>
+
+#define MIGRATE_KEY_LEN 32
+#define MIGRATE_DIGEST_LEN 32
+
+#define MIGRATE_MODE_EXPORT 0x01
+#define MIGRATE_MODE_IMPORT 0x02
+
+void migrate_keypair(uint8_t secret[MIGRATE_KEY_LEN],
+		     uint8_t pub[MIGRATE_KEY_LEN], const uint32_t cdi[8]);
+void migrate_measure(uint8_t digest[MIGRATE_DIGEST_LEN]);
+int migrate_transport_key(uint8_t key[MIGRATE_KEY_LEN],
+			  const uint8_t our_secret[MIGRATE_KEY_LEN],
+			  const uint8_t their_pub[MIGRATE_KEY_LEN],
+			  const uint8_t ephemeral_pub[MIGRATE_KEY_LEN],
+			  const uint8_t target_pub[MIGRATE_KEY_LEN],
+			  const uint8_t target_digest[MIGRATE_DIGEST_LEN]);
+
+#endif
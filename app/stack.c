@@ -0,0 +1,45 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "stack.h"
+#include <tk1_mem.h>
+
+// The stack grows down from the top of app RAM towards the end of
+// .bss, which the linker script marks with _ebss.
+extern uint32_t _ebss;
+
+#define STACK_TOP (TK1_RAM_BASE + TK1_RAM_SIZE)
+#define STACK_PAINT 0xa5a5a5a5
+// Left unpainted below our own frame
+#define STACK_PAINT_MARGIN 64
+
+// Fill the free stack with a known pattern. Called first thing in
+// main(), and kept out of line so that its own frame is the deepest
+// one in use while painting.
+__attribute__((noinline)) void stack_paint(void)
+{
+	volatile uint32_t marker;
+	uint32_t *end = (uint32_t *)((uint32_t)&marker - STACK_PAINT_MARGIN);
+
+	for (uint32_t *p = &_ebss; p < end; p++) {
+		*p = STACK_PAINT;
+	}
+}
+
+uint32_t stack_size(void)
+{
+	return STACK_TOP - (uint32_t)&_ebss;
+}
+
+// The deepest the stack has reached since stack_paint(): the first
+// word above _ebss that no longer holds the pattern.
+uint32_t stack_high_water(void)
+{
+	const uint32_t *p = &_ebss;
+
+	while ((uint32_t)p < STACK_TOP && *p == STACK_PAINT) {
+		p++;
+	}
+
+	return STACK_TOP - (uint32_t)p;
+}
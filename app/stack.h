@@ -0,0 +1,13 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <types.h>
+
+void stack_paint(void);
+uint32_t stack_size(void);
+uint32_t stack_high_water(void);
+
+#endif
@@ -43,3 +43,23 @@ touched:
 	// write, confirming we read the touch event
 	*touch = 0;
 }
+
+// Like wait_touch_ledflash(), but switching between two colours
+// without ever going dark, so it cannot be mistaken for it.
+void wait_touch_ledalternate(uint32_t first, uint32_t second,
+			     uint32_t loopcount)
+{
+	int led_first = 1;
+	*touch = 0;
+	for (;;) {
+		*led = led_first ? first : second;
+		for (int i = 0; i < loopcount; i++) {
+			if (*touch & (1 << TK1_MMIO_TOUCH_STATUS_EVENT_BIT)) {
+				goto touched;
+			}
+		}
+		led_first = !led_first;
+	}
+touched:
+	*touch = 0;
+}
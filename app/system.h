@@ -20,5 +20,7 @@
 void set_led(uint32_t led_value);
 void forever_redflash();
 void wait_touch_ledflash(uint32_t ledvalue, uint32_t loopcount);
+void wait_touch_ledalternate(uint32_t first, uint32_t second,
+			     uint32_t loopcount);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,19 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Hosted stand-in for tkey-libs' <lib.h>: libc provides the memory
+// functions, and there is no QEMU debug port to print to.
+
+#ifndef LIB_H
+#define LIB_H
+
+#include "types.h"
+#include <string.h>
+
+#define qemu_puts(s)
+#define qemu_putinthex(v)
+#define qemu_puthex(v)
+#define qemu_lf()
+#define qemu_hexdump(buf, len)
+
+#endif
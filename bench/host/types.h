@@ -0,0 +1,13 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Hosted stand-in for tkey-libs' <types.h>, so that the app's crypto
+// code can be built natively by bench/kernels.c.
+
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#endif
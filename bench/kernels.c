@@ -0,0 +1,362 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Native benchmark of the crypto kernels of the device app: HOTP
+// truncation (DT), HMAC-SHA-1, oath_hotp() and the AEAD sealing of
+// records and of the ToC, at the sizes the app uses. The kernels are
+// first checked against the RFC 4226 and RFC 6238 vectors and with
+// AEAD round trips; timing only starts once every check passes.
+//
+// Results go to stdout as JSON, progress and failures to stderr. Built
+// for RISC-V and run under a simulator, retired instructions per op
+// are reported as well. See bench-kernels in the Makefile.
+//
+// usage: kernels [-n ITERATIONS]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <monocypher/monocypher.h>
+
+// oath.c is included rather than linked to reach its static DT().
+#include "../app/oath/oath.c"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+// Without -n, each kernel runs for at least this long per round.
+#define BENCH_MIN_NS 100000000ULL
+#define BENCH_ROUNDS 5
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static volatile uint32_t sink;
+
+// RFC 4226, appendix D
+static const uint8_t rfc_key[20] = "12345678901234567890";
+static const uint32_t rfc4226_hotp[] = {
+	755224, 287082, 359152, 969429, 338314,
+	254676, 287922, 162583, 399871, 520489,
+};
+
+// RFC 6238, appendix B, SHA-1 with a 30 s timestep and 8 digits. The
+// device gets the time as a uint32, so the vector at 20000000000 s is
+// left out.
+static const struct {
+	uint32_t time;
+	uint32_t totp;
+} rfc6238_totp[] = {
+	{59, 94287082},		{1111111109, 7081804},	{1111111111, 14050471},
+	{1234567890, 89005924}, {2000000000, 69279037},
+};
+
+#define RECORD_BYTES sizeof(oath_record_secret_t)
+#define RECORD_AD_BYTES sizeof(oath_record_protected_t)
+#define TOC_BYTES (TOC_DESCRIPTORS_MAXCOUNT * sizeof(toc_record_descriptor_t))
+#define TOC_AD_BYTES sizeof(toc_header_protected_t)
+
+static int vectors_passed;
+static int vectors_failed;
+
+static void check(int ok, const char *what, uint64_t arg)
+{
+	if (ok) {
+		vectors_passed++;
+	} else {
+		vectors_failed++;
+		fprintf(stderr, "FAIL %s (%llu)\n", what, (unsigned long long)arg);
+	}
+}
+
+// Seals and opens a buffer of len bytes the way main.c does, then
+// checks that tampering with the MAC or the additional data is caught.
+static void check_aead_roundtrip(const char *what, uint32_t len,
+				 uint32_t ad_len)
+{
+	uint8_t key[32], nonce[XCHACHA20_NONCE_LEN], mac[XCHACHA20_MAC_LEN];
+	uint8_t ad[16];
+	uint8_t *plain = malloc(len);
+	uint8_t *buf = malloc(len);
+
+	for (uint32_t i = 0; i < sizeof(key); i++)
+		key[i] = i;
+	for (uint32_t i = 0; i < sizeof(nonce); i++)
+		nonce[i] = 0xa0 + i;
+	for (uint32_t i = 0; i < sizeof(ad); i++)
+		ad[i] = 0x50 + i;
+	for (uint32_t i = 0; i < len; i++)
+		plain[i] = buf[i] = i * 7;
+
+	crypto_lock_aead(mac, buf, key, nonce, ad, ad_len, buf, len);
+	check(memcmp(buf, plain, len) != 0, what, len);
+	check(crypto_unlock_aead(buf, key, nonce, mac, ad, ad_len, buf, len) == 0,
+	      what, len);
+	check(memcmp(buf, plain, len) == 0, what, len);
+
+	crypto_lock_aead(mac, buf, key, nonce, ad, ad_len, buf, len);
+	mac[0] ^= 1;
+	check(crypto_unlock_aead(buf, key, nonce, mac, ad, ad_len, buf, len) < 0,
+	      what, len);
+	mac[0] ^= 1;
+	ad[0] ^= 1;
+	check(crypto_unlock_aead(buf, key, nonce, mac, ad, ad_len, buf, len) < 0,
+	      what, len);
+
+	free(plain);
+	free(buf);
+}
+
+static void check_vectors(void)
+{
+	for (uint32_t i = 0; i < ARRAY_LEN(rfc4226_hotp); i++) {
+		check(oath_hotp(rfc_key, sizeof(rfc_key), i, 6) == rfc4226_hotp[i],
+		      "RFC 4226 HOTP", i);
+	}
+
+	// The device divides a 32-bit time, the last vector needs 64 bits
+	for (uint32_t i = 0; i < ARRAY_LEN(rfc6238_totp); i++) {
+		check(oath_hotp(rfc_key, sizeof(rfc_key), rfc6238_totp[i].time / 30,
+				8) == rfc6238_totp[i].totp,
+		      "RFC 6238 TOTP", rfc6238_totp[i].time);
+	}
+
+	check_aead_roundtrip("AEAD record round trip", RECORD_BYTES,
+			     RECORD_AD_BYTES);
+	check_aead_roundtrip("AEAD ToC round trip", TOC_BYTES, TOC_AD_BYTES);
+}
+
+// Kernel state: one buffer large enough for the full ToC, keyed and
+// filled once so that only the kernel itself is timed.
+static struct {
+	uint8_t key[RECORD_KEY_MAXLEN];
+	uint8_t aead_key[32];
+	uint8_t nonce[XCHACHA20_NONCE_LEN];
+	uint8_t mac[XCHACHA20_MAC_LEN];
+	uint8_t ad[sizeof(oath_record_protected_t)];
+	uint8_t hs[20];
+	uint8_t buf[sizeof(decrypted_toc_t)];
+	uint8_t sealed_nonce[XCHACHA20_NONCE_LEN];
+	uint8_t sealed_mac[XCHACHA20_MAC_LEN];
+	uint8_t sealed[sizeof(decrypted_toc_t)];
+} st;
+
+typedef struct kernel kernel_t;
+struct kernel {
+	const char *name;
+	uint32_t bytes;
+	// Additional data authenticated by the AEAD kernels
+	uint32_t ad_bytes;
+	void (*fn)(const kernel_t *k, uint64_t i);
+	void (*setup)(const kernel_t *k);
+};
+
+static void k_dt(const kernel_t *k, uint64_t i)
+{
+	st.hs[19] = i;
+	sink += DT(st.hs);
+}
+
+static void k_hmac_sha1(const kernel_t *k, uint64_t i)
+{
+	hmac_sha1_ctx ctx;
+	uint8_t C[8] = {0, 0, 0, 0, 0, 0, 0, i};
+
+	hmac_sha1_init(&ctx, st.key, k->bytes);
+	hmac_sha1_update(&ctx, C, sizeof(C));
+	hmac_sha1_final(&ctx, st.hs);
+	sink += st.hs[0];
+}
+
+static void k_oath_hotp(const kernel_t *k, uint64_t i)
+{
+	sink += oath_hotp(st.key, k->bytes, i, 6);
+}
+
+static void k_lock_aead(const kernel_t *k, uint64_t i)
+{
+	st.nonce[0] = i;
+	crypto_lock_aead(st.mac, st.buf, st.aead_key, st.nonce, st.ad,
+			 k->ad_bytes, st.buf, k->bytes);
+	sink += st.mac[0];
+}
+
+// Opens a buffer sealed once by setup_unlock_aead(), into another
+// buffer so that it stays sealed for the next iteration.
+static void setup_unlock_aead(const kernel_t *k)
+{
+	crypto_lock_aead(st.sealed_mac, st.sealed, st.aead_key, st.sealed_nonce,
+			 st.ad, k->ad_bytes, st.buf, k->bytes);
+}
+
+static void k_unlock_aead(const kernel_t *k, uint64_t i)
+{
+	sink += crypto_unlock_aead(st.buf, st.aead_key, st.sealed_nonce,
+				   st.sealed_mac, st.ad, k->ad_bytes, st.sealed,
+				   k->bytes);
+}
+
+// HMAC and HOTP run with the RFC key size and the largest key a record
+// holds, AEAD over a full record and a full ToC.
+static const kernel_t kernels[] = {
+	{"dt", 20, 0, k_dt, NULL},
+	{"hmac_sha1", 20, 0, k_hmac_sha1, NULL},
+	{"hmac_sha1", RECORD_KEY_MAXLEN, 0, k_hmac_sha1, NULL},
+	{"oath_hotp", 20, 0, k_oath_hotp, NULL},
+	{"oath_hotp", RECORD_KEY_MAXLEN, 0, k_oath_hotp, NULL},
+	{"lock_aead_record", RECORD_BYTES, RECORD_AD_BYTES, k_lock_aead, NULL},
+	{"unlock_aead_record", RECORD_BYTES, RECORD_AD_BYTES, k_unlock_aead,
+	 setup_unlock_aead},
+	{"lock_aead_toc", TOC_BYTES, TOC_AD_BYTES, k_lock_aead, NULL},
+	{"unlock_aead_toc", TOC_BYTES, TOC_AD_BYTES, k_unlock_aead,
+	 setup_unlock_aead},
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__riscv)
+#define HAVE_INSTRET 1
+static uint64_t instret(void)
+{
+#if __riscv_xlen == 32
+	uint32_t hi, lo, hi2;
+
+	do {
+		__asm__ volatile("rdinstreth %0" : "=r"(hi));
+		__asm__ volatile("rdinstret %0" : "=r"(lo));
+		__asm__ volatile("rdinstreth %0" : "=r"(hi2));
+	} while (hi != hi2);
+
+	return (uint64_t)hi << 32 | lo;
+#else
+	uint64_t n;
+
+	__asm__ volatile("rdinstret %0" : "=r"(n));
+	return n;
+#endif
+}
+#else
+#define HAVE_INSTRET 0
+static uint64_t instret(void)
+{
+	return 0;
+}
+#endif
+
+typedef struct {
+	uint64_t iterations;
+	double ns_per_op;
+	double instret_per_op;
+} result_t;
+
+static int cmp_double(const void *l, const void *r)
+{
+	double a = *(const double *)l, b = *(const double *)r;
+
+	return (a > b) - (a < b);
+}
+
+// Runs a kernel for BENCH_ROUNDS rounds of the same number of
+// iterations and keeps the median. Without a fixed count, the count
+// doubles until a round takes at least BENCH_MIN_NS.
+static result_t run_kernel(const kernel_t *k, uint64_t iterations)
+{
+	result_t res = {0};
+	double ns[BENCH_ROUNDS], ins[BENCH_ROUNDS];
+
+	if (k->setup != NULL)
+		k->setup(k);
+
+	if (iterations == 0) {
+		iterations = 1;
+		for (;;) {
+			uint64_t t0 = now_ns();
+			for (uint64_t i = 0; i < iterations; i++)
+				k->fn(k, i);
+			if (now_ns() - t0 >= BENCH_MIN_NS)
+				break;
+			iterations *= 2;
+		}
+	}
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		uint64_t i0 = instret();
+		uint64_t t0 = now_ns();
+		for (uint64_t i = 0; i < iterations; i++)
+			k->fn(k, i);
+		uint64_t t1 = now_ns();
+		uint64_t i1 = instret();
+
+		ns[r] = (double)(t1 - t0) / iterations;
+		ins[r] = (double)(i1 - i0) / iterations;
+	}
+
+	qsort(ns, BENCH_ROUNDS, sizeof(double), cmp_double);
+	qsort(ins, BENCH_ROUNDS, sizeof(double), cmp_double);
+	res.iterations = iterations;
+	res.ns_per_op = ns[BENCH_ROUNDS / 2];
+	res.instret_per_op = ins[BENCH_ROUNDS / 2];
+
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t iterations = 0;
+
+	if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+		iterations = strtoull(argv[2], NULL, 10);
+	} else if (argc != 1) {
+		fprintf(stderr, "usage: %s [-n ITERATIONS]\n", argv[0]);
+		return 2;
+	}
+
+	check_vectors();
+	fprintf(stderr, "%d checks passed, %d failed\n", vectors_passed,
+		vectors_failed);
+	if (vectors_failed != 0) {
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < sizeof(st.key); i++)
+		st.key[i] = rfc_key[i % sizeof(rfc_key)];
+	for (uint32_t i = 0; i < sizeof(st.aead_key); i++)
+		st.aead_key[i] = i;
+
+	printf("{\n");
+	printf("  \"revision\": \"%s\",\n", BENCH_REVISION);
+	printf("  \"target\": \"%s\",\n", HAVE_INSTRET ? "riscv" : "host");
+	printf("  \"compiler\": \"%s\",\n", __VERSION__);
+	printf("  \"toc_descriptors_maxcount\": %d,\n", TOC_DESCRIPTORS_MAXCOUNT);
+	printf("  \"record_name_maxlen\": %d,\n", RECORD_NAME_MAXLEN);
+	printf("  \"checks_passed\": %d,\n", vectors_passed);
+	printf("  \"kernels\": [\n");
+
+	for (uint32_t i = 0; i < ARRAY_LEN(kernels); i++) {
+		const kernel_t *k = &kernels[i];
+
+		fprintf(stderr, "%s/%u...\n", k->name, k->bytes);
+		result_t res = run_kernel(k, iterations);
+
+		printf("    {\"name\": \"%s\", \"bytes\": %u, \"iterations\": %llu, "
+		       "\"ns_per_op\": %.1f",
+		       k->name, k->bytes, (unsigned long long)res.iterations,
+		       res.ns_per_op);
+		if (HAVE_INSTRET) {
+			printf(", \"instret_per_op\": %.1f", res.instret_per_op);
+		}
+		printf("}%s\n", i + 1 < ARRAY_LEN(kernels) ? "," : "");
+	}
+
+	printf("  ]\n");
+	printf("}\n");
+
+	return 0;
+}
@@ -0,0 +1,405 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"crypto/hmac"
+	"crypto/sha1" // nolint:gosec // HOTP is defined over HMAC-SHA-1
+	"encoding/base32"
+	"encoding/binary"
+	"encoding/json"
+	"fmt"
+	"io"
+	"math"
+	"sort"
+	"strings"
+	"time"
+
+	"github.com/nowitis/pattern/tkeyoath"
+)
+
+// Records provisioned on the device for the calculate workloads.
+// Neither requires touch, so the benchmark can run unattended.
+const (
+	benchSecret   = "JBSWY3DPEHPK3PXP"
+	benchTimestep = 30
+	benchCounter  = 42
+	benchDigits   = 6
+)
+
+var benchWorkloadNames = []string{"toc", "put", "totp", "hotp", "list", "lookup"}
+
+type benchConfig struct {
+	workloads  []string
+	iterations int
+	duration   time.Duration
+}
+
+type benchLatency struct {
+	Min  int64 `json:"min_ns"`
+	Mean int64 `json:"mean_ns"`
+	P50  int64 `json:"p50_ns"`
+	P95  int64 `json:"p95_ns"`
+	P99  int64 `json:"p99_ns"`
+	Max  int64 `json:"max_ns"`
+}
+
+type benchBucket struct {
+	UpperBoundUs int64 `json:"le_us"`
+	Count        int   `json:"count"`
+}
+
+type benchResult struct {
+	Workload   string        `json:"workload"`
+	Ops        int           `json:"ops"`
+	Errors     int           `json:"errors"`
+	Desyncs    int           `json:"desyncs"`
+	Mismatches int           `json:"mismatches"`
+	Aborted    bool          `json:"aborted"`
+	ElapsedNs  int64         `json:"elapsed_ns"`
+	OpsPerSec  float64       `json:"ops_per_sec"`
+	TxPerOp    float64       `json:"tx_bytes_per_op"`
+	RxPerOp    float64       `json:"rx_bytes_per_op"`
+	Latency    benchLatency  `json:"latency"`
+	Histogram  []benchBucket `json:"histogram"`
+}
+
+type benchReport struct {
+	Port       string        `json:"port"`
+	Speed      int           `json:"speed"`
+	AppName    string        `json:"app_name"`
+	AppVersion uint32        `json:"app_version"`
+	Started    time.Time     `json:"started"`
+	Iterations int           `json:"iterations,omitempty"`
+	Duration   string        `json:"duration,omitempty"`
+	Results    []benchResult `json:"results"`
+}
+
+// benchSession holds the device-side fixtures shared by all
+// workloads: a sealed ToC listing both records, and the sealed
+// records themselves.
+type benchSession struct {
+	app         tkeyoath.App
+	toc         []byte
+	totpRecord  []byte
+	hotpRecord  []byte
+	descriptors int
+}
+
+func parseBenchWorkloads(spec string) ([]string, error) {
+	if spec == "all" {
+		return benchWorkloadNames, nil
+	}
+
+	var workloads []string
+	for _, name := range strings.Split(spec, ",") {
+		name = strings.TrimSpace(name)
+		known := false
+		for _, w := range benchWorkloadNames {
+			if name == w {
+				known = true
+				break
+			}
+		}
+		if !known {
+			return nil, fmt.Errorf("unknown workload %q (want one of %s, or all)",
+				name, strings.Join(benchWorkloadNames, ","))
+		}
+		workloads = append(workloads, name)
+	}
+
+	return workloads, nil
+}
+
+func runBench(app tkeyoath.App, cfg benchConfig, report *benchReport, out io.Writer) error {
+	nameVer, err := app.GetAppNameVersion()
+	if err != nil {
+		return fmt.Errorf("GetAppNameVersion: %w", err)
+	}
+	report.AppName = nameVer.Name0 + nameVer.Name1
+	report.AppVersion = nameVer.Version
+	report.Started = time.Now().UTC()
+	if cfg.duration > 0 {
+		report.Duration = cfg.duration.String()
+	} else {
+		report.Iterations = cfg.iterations
+	}
+
+	s := &benchSession{app: app}
+	if err = s.provision(); err != nil {
+		return fmt.Errorf("provision: %w", err)
+	}
+
+	for _, name := range cfg.workloads {
+		le.Printf("Running workload %s...\n", name)
+		report.Results = append(report.Results, s.run(name, cfg))
+	}
+
+	enc := json.NewEncoder(out)
+	enc.SetIndent("", "  ")
+	if err = enc.Encode(report); err != nil {
+		return fmt.Errorf("Encode: %w", err)
+	}
+
+	return nil
+}
+
+// provision starts from an empty ToC, adds one TOTP and one HOTP
+// record, and keeps the sealed ToC so that every workload can start
+// from the same loaded state.
+func (s *benchSession) provision() error {
+	var err error
+
+	if err = s.app.LoadToC(nil); err != nil {
+		return fmt.Errorf("LoadToC: %w", err)
+	}
+
+	s.totpRecord, err = s.put(tkeyoath.MakePutRequestTOTP(benchSecret, "bench-totp", benchTimestep, false, benchDigits))
+	if err != nil {
+		return err
+	}
+	s.hotpRecord, err = s.put(tkeyoath.MakePutRequestHOTP(benchSecret, "bench-hotp", benchCounter, false, benchDigits))
+	if err != nil {
+		return err
+	}
+	s.descriptors = 2
+
+	if s.toc, err = s.app.GetEncryptedToC(); err != nil {
+		return fmt.Errorf("GetEncryptedToC: %w", err)
+	}
+
+	return s.reset()
+}
+
+func (s *benchSession) put(request []byte) ([]byte, error) {
+	if request == nil {
+		return nil, fmt.Errorf("could not build PUT request")
+	}
+	if err := s.app.PutRecord(request); err != nil {
+		return nil, fmt.Errorf("PutRecord: %w", err)
+	}
+	record, err := s.app.GetPutResult(tkeyoath.SecureOathRecordSize)
+	if err != nil {
+		return nil, fmt.Errorf("GetPutResult: %w", err)
+	}
+
+	return record, nil
+}
+
+// reset brings the device back to the provisioned ToC, with no
+// transfer in progress.
+func (s *benchSession) reset() error {
+	if err := s.app.LoadToC(s.toc); err != nil {
+		return fmt.Errorf("LoadToC: %w", err)
+	}
+	s.descriptors = 2
+
+	return nil
+}
+
+// op runs one iteration of a workload. A mismatch is a successful
+// exchange whose result is not what the host computed.
+func (s *benchSession) op(name string) (bool, error) {
+	switch name {
+	case "toc":
+		toc, err := s.app.GetEncryptedToC()
+		if err != nil {
+			return false, fmt.Errorf("GetEncryptedToC: %w", err)
+		}
+		if err = s.app.LoadToC(toc); err != nil {
+			return false, fmt.Errorf("LoadToC: %w", err)
+		}
+		return len(toc) != len(s.toc), nil
+
+	case "put":
+		record, err := s.put(tkeyoath.MakePutRequestTOTP(benchSecret, "bench-put", benchTimestep, false, benchDigits))
+		if err != nil {
+			return false, err
+		}
+		s.descriptors++
+		return len(record) != len(s.totpRecord), nil
+
+	case "totp":
+		before := time.Now().Unix()
+		code, _, err := s.app.Calculate(tkeyoath.MakeCalculateRequest(s.totpRecord))
+		if err != nil {
+			return false, fmt.Errorf("Calculate: %w", err)
+		}
+		after := time.Now().Unix()
+		return code != hostHOTP(benchSecret, uint64(before/benchTimestep), benchDigits) &&
+			code != hostHOTP(benchSecret, uint64(after/benchTimestep), benchDigits), nil
+
+	case "hotp":
+		// The same sealed record is sent every time, so the device
+		// always computes the code for the provisioned counter.
+		code, _, err := s.app.Calculate(tkeyoath.MakeCalculateRequest(s.hotpRecord))
+		if err != nil {
+			return false, fmt.Errorf("Calculate: %w", err)
+		}
+		return code != hostHOTP(benchSecret, benchCounter, benchDigits), nil
+
+	case "list":
+		list, err := s.app.GetList()
+		if err != nil {
+			return false, fmt.Errorf("GetList: %w", err)
+		}
+		return len(list) != s.descriptors*tkeyoath.TocRecordDescriptorSize, nil
+
+	case "lookup":
+		slots, err := s.app.Lookup("bench-totp", false)
+		if err != nil {
+			return false, fmt.Errorf("Lookup: %w", err)
+		}
+		return len(slots) != 1 || slots[0] != 0, nil
+	}
+
+	return false, fmt.Errorf("unknown workload %q", name)
+}
+
+// run executes a workload for the configured number of iterations or
+// duration. After a failed exchange the device may be stuck waiting
+// for the rest of a chunked transfer; if reloading the ToC does not
+// bring it back, the session is counted as desynchronised and the
+// workload is aborted.
+func (s *benchSession) run(name string, cfg benchConfig) benchResult {
+	result := benchResult{Workload: name}
+	var samples []time.Duration
+
+	tx0, rx0 := s.app.WireBytes()
+	start := time.Now()
+	deadline := start.Add(cfg.duration)
+	for i := 0; ; i++ {
+		if cfg.duration > 0 {
+			if !time.Now().Before(deadline) {
+				break
+			}
+		} else if i >= cfg.iterations {
+			break
+		}
+
+		// Keep PUT from overflowing the ToC; not part of the sample.
+		if name == "put" && s.descriptors >= tkeyoath.TocDescriptorsMaxCount {
+			if err := s.reset(); err != nil {
+				result.Desyncs++
+				result.Aborted = true
+				break
+			}
+		}
+
+		t0 := time.Now()
+		mismatch, err := s.op(name)
+		elapsed := time.Since(t0)
+
+		if err != nil {
+			le.Printf("%s: %v\n", name, err)
+			result.Errors++
+			if err = s.reset(); err != nil {
+				result.Desyncs++
+				result.Aborted = true
+				break
+			}
+			continue
+		}
+
+		result.Ops++
+		samples = append(samples, elapsed)
+		if mismatch {
+			result.Mismatches++
+		}
+	}
+	total := time.Since(start)
+	tx1, rx1 := s.app.WireBytes()
+
+	if name == "put" && !result.Aborted {
+		if err := s.reset(); err != nil {
+			result.Desyncs++
+		}
+	}
+
+	result.ElapsedNs = total.Nanoseconds()
+	if total > 0 {
+		result.OpsPerSec = float64(result.Ops) / total.Seconds()
+	}
+	if result.Ops > 0 {
+		result.TxPerOp = float64(tx1-tx0) / float64(result.Ops)
+		result.RxPerOp = float64(rx1-rx0) / float64(result.Ops)
+	}
+	result.Latency, result.Histogram = summarizeLatency(samples)
+
+	return result
+}
+
+// summarizeLatency computes percentiles over the raw samples and a
+// histogram with power-of-two microsecond buckets.
+func summarizeLatency(samples []time.Duration) (benchLatency, []benchBucket) {
+	var lat benchLatency
+	if len(samples) == 0 {
+		return lat, nil
+	}
+
+	sorted := make([]time.Duration, len(samples))
+	copy(sorted, samples)
+	sort.Slice(sorted, func(i, j int) bool { return sorted[i] < sorted[j] })
+
+	percentile := func(p float64) int64 {
+		idx := int(math.Ceil(p*float64(len(sorted)))) - 1
+		if idx < 0 {
+			idx = 0
+		}
+		return sorted[idx].Nanoseconds()
+	}
+
+	var sum time.Duration
+	for _, d := range sorted {
+		sum += d
+	}
+
+	lat.Min = sorted[0].Nanoseconds()
+	lat.Mean = (sum / time.Duration(len(sorted))).Nanoseconds()
+	lat.P50 = percentile(0.50)
+	lat.P95 = percentile(0.95)
+	lat.P99 = percentile(0.99)
+	lat.Max = sorted[len(sorted)-1].Nanoseconds()
+
+	var hist []benchBucket
+	bound := int64(1)
+	for _, d := range sorted {
+		us := d.Microseconds()
+		for us > bound {
+			bound <<= 1
+		}
+		if len(hist) == 0 || hist[len(hist)-1].UpperBoundUs != bound {
+			hist = append(hist, benchBucket{UpperBoundUs: bound})
+		}
+		hist[len(hist)-1].Count++
+	}
+
+	return lat, hist
+}
+
+// hostHOTP computes RFC 4226 HOTP on the host, to check the codes
+// returned by the device.
+func hostHOTP(secret string, seq uint64, digits int) uint32 {
+	b32NoPadding := base32.StdEncoding.WithPadding(base32.NoPadding)
+	key, err := b32NoPadding.DecodeString(secret)
+	if err != nil {
+		return math.MaxUint32
+	}
+
+	var msg [8]byte
+	binary.BigEndian.PutUint64(msg[:], seq)
+	mac := hmac.New(sha1.New, key)
+	mac.Write(msg[:])
+	hs := mac.Sum(nil)
+
+	offset := hs[len(hs)-1] & 0x0f
+	code := binary.BigEndian.Uint32(hs[offset:]) & 0x7fffffff
+
+	mod := uint32(1)
+	for ; digits > 0; digits-- {
+		mod *= 10
+	}
+
+	return code % mod
+}
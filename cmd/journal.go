@@ -0,0 +1,438 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"os"
+	"path/filepath"
+
+	"github.com/nowitis/pattern/tkeyoath"
+)
+
+// A bundle is an append-only journal of sealed objects. It starts
+// with journalMagic, followed by entries framed as:
+//
+//	type (1) | slot (1) | payload length (2, LE) | payload | CRC-32 (4, LE)
+//
+// where the CRC-32 (IEEE) covers everything before it in the entry.
+// An entryToC carries a ToC as exported by the device, an
+// entryRecord carries the sealed record for a ToC slot, and an
+// entryMigration marks a bundle exported for another app version,
+// carrying the ephemeral key it was sealed with. Later
+// entries supersede earlier ones, so adding a record or bumping a
+// HOTP counter only appends a few hundred bytes. Opening a bundle
+// replays the entries and ignores a torn tail left by an interrupted
+// write, which the next append or compaction drops. An entry that is
+// damaged but followed by more data is not a torn write, and the
+// bundle is reported corrupt and left untouched. Compact rewrites the
+// bundle with only the live entries.
+const journalMagic = "OATHJRN1"
+
+const (
+	entryToC       = 0x01
+	entryRecord    = 0x02
+	entryMigration = 0x03
+)
+
+const (
+	entryHeaderLen  = 4
+	entryTrailerLen = 4
+)
+
+var (
+	errJournalBadMagic = errors.New("not a bundle (bad magic)")
+	errJournalCorrupt  = errors.New("bundle is corrupt")
+)
+
+type Journal struct {
+	f    *os.File
+	path string
+	size int64 // end of the last valid entry
+	torn int64 // bytes of torn tail after it, dropped on the next write
+
+	toc       []byte
+	records   map[uint8]journalRef
+	migration []byte
+}
+
+// journalRef locates the payload of the latest entry for a slot.
+type journalRef struct {
+	offset int64
+	length int
+}
+
+// CreateJournal creates a new, empty bundle at path, replacing any
+// existing file.
+func CreateJournal(path string) (*Journal, error) {
+	f, err := os.OpenFile(path, os.O_RDWR|os.O_CREATE|os.O_TRUNC, 0o600)
+	if err != nil {
+		return nil, fmt.Errorf("OpenFile: %w", err)
+	}
+
+	j := &Journal{f: f, path: path, records: map[uint8]journalRef{}}
+	if _, err = f.Write([]byte(journalMagic)); err != nil {
+		f.Close()
+		return nil, fmt.Errorf("Write: %w", err)
+	}
+	if err = f.Sync(); err != nil {
+		f.Close()
+		return nil, fmt.Errorf("Sync: %w", err)
+	}
+	syncDir(path)
+	j.size = int64(len(journalMagic))
+
+	return j, nil
+}
+
+// OpenJournal opens an existing bundle and recovers the latest valid
+// state from it. Opening never modifies the file: a torn tail is only
+// truncated by the first append, so that new entries follow the last
+// valid one.
+func OpenJournal(path string) (*Journal, error) {
+	f, err := os.OpenFile(path, os.O_RDWR, 0)
+	if err != nil {
+		return nil, fmt.Errorf("OpenFile: %w", err)
+	}
+
+	j := &Journal{f: f, path: path, records: map[uint8]journalRef{}}
+	if err = j.recover(); err != nil {
+		f.Close()
+		return nil, err
+	}
+
+	return j, nil
+}
+
+func (j *Journal) recover() error {
+	info, err := j.f.Stat()
+	if err != nil {
+		return fmt.Errorf("Stat: %w", err)
+	}
+
+	magic := make([]byte, len(journalMagic))
+	if _, err = j.f.ReadAt(magic, 0); err != nil || string(magic) != journalMagic {
+		return errJournalBadMagic
+	}
+
+	offset := int64(len(journalMagic))
+	hdr := make([]byte, entryHeaderLen)
+	for offset < info.Size() {
+		// An entry that runs past the end of the file is torn
+		if _, err = j.f.ReadAt(hdr, offset); err != nil {
+			break
+		}
+
+		length := int(binary.LittleEndian.Uint16(hdr[2:]))
+		entry := make([]byte, entryHeaderLen+length+entryTrailerLen)
+		if _, err = j.f.ReadAt(entry, offset); err != nil {
+			break
+		}
+
+		body := entry[:entryHeaderLen+length]
+		sum := binary.LittleEndian.Uint32(entry[entryHeaderLen+length:])
+		if crc32.ChecksumIEEE(body) != sum {
+			// The last entry may be torn, as its write may not
+			// have reached the disk in order. Anything followed
+			// by more data is damage, not an interrupted append.
+			if offset+int64(len(entry)) < info.Size() {
+				return fmt.Errorf("%w: bad checksum of the entry at offset %d, with %d bytes after it",
+					errJournalCorrupt, offset, info.Size()-offset-int64(len(entry)))
+			}
+			break
+		}
+
+		payload := body[entryHeaderLen:]
+		switch hdr[0] {
+		case entryToC:
+			j.toc = payload
+		case entryRecord:
+			j.records[hdr[1]] = journalRef{offset + entryHeaderLen, length}
+		case entryMigration:
+			j.migration = payload
+		default:
+			// Framing is intact, so skip entries we do not know.
+		}
+
+		offset += int64(len(entry))
+	}
+
+	// A length field damaged in place can also make an entry look
+	// like it runs past the end: a valid entry further on tells.
+	if offset < info.Size() && j.validEntryAfter(offset+1, info.Size()) {
+		return fmt.Errorf("%w: bad entry at offset %d, with valid entries after it",
+			errJournalCorrupt, offset)
+	}
+
+	j.size = offset
+	j.torn = info.Size() - offset
+	if j.torn > 0 {
+		le.Printf("Bundle %s: ignoring %d bytes of torn tail, dropped on the next write\n",
+			j.path, j.torn)
+	}
+
+	return nil
+}
+
+// validEntryAfter tells whether an entry with a valid checksum starts
+// anywhere in [from, size).
+func (j *Journal) validEntryAfter(from, size int64) bool {
+	rest := make([]byte, size-from)
+	if _, err := j.f.ReadAt(rest, from); err != nil {
+		return false
+	}
+
+	for i := 0; i+entryHeaderLen+entryTrailerLen <= len(rest); i++ {
+		length := int(binary.LittleEndian.Uint16(rest[i+2:]))
+		end := i + entryHeaderLen + length
+		if end+entryTrailerLen > len(rest) {
+			continue
+		}
+		if crc32.ChecksumIEEE(rest[i:end]) == binary.LittleEndian.Uint32(rest[end:]) {
+			return true
+		}
+	}
+
+	return false
+}
+
+func encodeEntry(dst []byte, typ uint8, slot uint8, payload []byte) ([]byte, error) {
+	if len(payload) > 0xffff {
+		return nil, fmt.Errorf("entry too large: %d bytes", len(payload))
+	}
+
+	start := len(dst)
+	dst = append(dst, typ, slot, 0, 0)
+	binary.LittleEndian.PutUint16(dst[start+2:], uint16(len(payload)))
+	dst = append(dst, payload...)
+	dst = binary.LittleEndian.AppendUint32(dst, crc32.ChecksumIEEE(dst[start:]))
+
+	return dst, nil
+}
+
+// write appends already encoded entries with a single write and
+// sync.
+func (j *Journal) write(entries []byte) error {
+	if j.torn > 0 {
+		if err := j.f.Truncate(j.size); err != nil {
+			return fmt.Errorf("Truncate: %w", err)
+		}
+		j.torn = 0
+	}
+	if _, err := j.f.WriteAt(entries, j.size); err != nil {
+		return fmt.Errorf("WriteAt: %w", err)
+	}
+	if err := j.f.Sync(); err != nil {
+		return fmt.Errorf("Sync: %w", err)
+	}
+	j.size += int64(len(entries))
+
+	return nil
+}
+
+func (j *Journal) append(typ uint8, slot uint8, payload []byte) (int64, error) {
+	entry, err := encodeEntry(nil, typ, slot, payload)
+	if err != nil {
+		return 0, err
+	}
+
+	offset := j.size
+	if err = j.write(entry); err != nil {
+		return 0, err
+	}
+
+	return offset + entryHeaderLen, nil
+}
+
+// AppendToC durably appends a new version of the sealed ToC.
+func (j *Journal) AppendToC(toc []byte) error {
+	if _, err := j.append(entryToC, 0, toc); err != nil {
+		return err
+	}
+	j.toc = append([]byte(nil), toc...)
+
+	return nil
+}
+
+// AppendRecord durably appends the sealed record for ToC slot slot,
+// superseding any earlier one.
+func (j *Journal) AppendRecord(slot int, record []byte) error {
+	if slot < 0 || slot > 0xff {
+		return fmt.Errorf("invalid slot %d", slot)
+	}
+
+	offset, err := j.append(entryRecord, uint8(slot), record)
+	if err != nil {
+		return err
+	}
+	j.records[uint8(slot)] = journalRef{offset, len(record)}
+
+	return nil
+}
+
+// AppendRecords durably appends sealed records for several slots
+// with a single write and sync.
+func (j *Journal) AppendRecords(slots []int, records [][]byte) error {
+	var entries []byte
+	offsets := make([]int64, len(slots))
+	for i, slot := range slots {
+		if slot < 0 || slot > 0xff {
+			return fmt.Errorf("invalid slot %d", slot)
+		}
+
+		var err error
+		offsets[i] = j.size + int64(len(entries)) + entryHeaderLen
+		if entries, err = encodeEntry(entries, entryRecord, uint8(slot), records[i]); err != nil {
+			return err
+		}
+	}
+
+	if err := j.write(entries); err != nil {
+		return err
+	}
+	for i, slot := range slots {
+		j.records[uint8(slot)] = journalRef{offsets[i], len(records[i])}
+	}
+
+	return nil
+}
+
+// AppendMigrationKey marks the bundle as exported for another app
+// version, keeping the ephemeral key needed to import it.
+func (j *Journal) AppendMigrationKey(key []byte) error {
+	if _, err := j.append(entryMigration, 0, key); err != nil {
+		return err
+	}
+	j.migration = append([]byte(nil), key...)
+
+	return nil
+}
+
+// MigrationKey returns the ephemeral key of an exported bundle, or
+// nil if the bundle is sealed for the running app.
+func (j *Journal) MigrationKey() []byte {
+	return j.migration
+}
+
+// ToC returns the latest sealed ToC, or nil if none was written.
+func (j *Journal) ToC() []byte {
+	return j.toc
+}
+
+// RecordCount is the number of records listed in the latest ToC,
+// read from its unencrypted header.
+func (j *Journal) RecordCount() int {
+	count, err := tkeyoath.ToCDescriptorCount(j.toc)
+	if err != nil {
+		return 0
+	}
+
+	return count
+}
+
+// Record reads the latest sealed record for a slot from disk.
+func (j *Journal) Record(slot int) ([]byte, error) {
+	ref, ok := j.records[uint8(slot)]
+	if !ok || slot < 0 || slot > 0xff {
+		return nil, fmt.Errorf("no record for slot %d", slot)
+	}
+
+	record := make([]byte, ref.length)
+	if _, err := j.f.ReadAt(record, ref.offset); err != nil {
+		return nil, fmt.Errorf("ReadAt: %w", err)
+	}
+
+	return record, nil
+}
+
+// Compact rewrites the bundle with only the latest ToC and the latest
+// record of every slot it lists, the records with a single write. The
+// new bundle is written next to the old one, synced and renamed over
+// it, so a crash leaves either the old or the new bundle.
+func (j *Journal) Compact() error {
+	tmpPath := j.path + ".compact"
+	tmp, err := CreateJournal(tmpPath)
+	if err != nil {
+		return err
+	}
+
+	err = func() error {
+		if j.migration != nil {
+			if err := tmp.AppendMigrationKey(j.migration); err != nil {
+				return err
+			}
+		}
+		count := j.RecordCount()
+		slots := make([]int, count)
+		records := make([][]byte, count)
+		for slot := range slots {
+			record, err := j.Record(slot)
+			if err != nil {
+				return err
+			}
+			slots[slot], records[slot] = slot, record
+		}
+		if count > 0 {
+			if err := tmp.AppendRecords(slots, records); err != nil {
+				return err
+			}
+		}
+		if j.toc != nil {
+			return tmp.AppendToC(j.toc)
+		}
+		return nil
+	}()
+	if err != nil {
+		tmp.Close()
+		os.Remove(tmpPath)
+		return err
+	}
+
+	if err = tmp.f.Close(); err != nil {
+		os.Remove(tmpPath)
+		return fmt.Errorf("Close: %w", err)
+	}
+	if err = j.f.Close(); err != nil {
+		return fmt.Errorf("Close: %w", err)
+	}
+	if err = os.Rename(tmpPath, j.path); err != nil {
+		return fmt.Errorf("Rename: %w", err)
+	}
+	syncDir(j.path)
+
+	compacted, err := OpenJournal(j.path)
+	if err != nil {
+		return err
+	}
+	*j = *compacted
+
+	return nil
+}
+
+// Size is the number of bytes of valid journal on disk.
+func (j *Journal) Size() int64 {
+	return j.size
+}
+
+func (j *Journal) Close() error {
+	if err := j.f.Close(); err != nil && !errors.Is(err, os.ErrClosed) {
+		return fmt.Errorf("Close: %w", err)
+	}
+
+	return nil
+}
+
+// syncDir makes a file creation or rename durable. This is best
+// effort: not every platform lets us sync a directory.
+func syncDir(path string) {
+	d, err := os.Open(filepath.Dir(path))
+	if err != nil {
+		return
+	}
+	_ = d.Sync()
+	d.Close()
+}
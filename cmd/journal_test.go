@@ -0,0 +1,160 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"bytes"
+	"errors"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"github.com/nowitis/pattern/tkeyoath"
+)
+
+func writeTestJournal(t *testing.T) (string, []byte) {
+	t.Helper()
+
+	path := filepath.Join(t.TempDir(), "test.bundle")
+	j, err := CreateJournal(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err = j.AppendRecord(0, bytes.Repeat([]byte{0xaa}, 100)); err != nil {
+		t.Fatal(err)
+	}
+	if err = j.AppendRecord(1, bytes.Repeat([]byte{0xbb}, 100)); err != nil {
+		t.Fatal(err)
+	}
+	if err = j.AppendToC(bytes.Repeat([]byte{0xcc}, 50)); err != nil {
+		t.Fatal(err)
+	}
+	j.Close()
+
+	data, err := os.ReadFile(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	return path, data
+}
+
+func TestJournalCorruptEntryLeavesFile(t *testing.T) {
+	path, data := writeTestJournal(t)
+
+	// A byte of the first entry's payload, then of its length
+	for _, at := range []int{len(journalMagic) + entryHeaderLen + 3, len(journalMagic) + 2} {
+		damaged := append([]byte(nil), data...)
+		damaged[at] ^= 0x40
+		if err := os.WriteFile(path, damaged, 0o600); err != nil {
+			t.Fatal(err)
+		}
+
+		if _, err := OpenJournal(path); !errors.Is(err, errJournalCorrupt) {
+			t.Fatalf("byte %d: OpenJournal: %v, want %v", at, err, errJournalCorrupt)
+		}
+		after, err := os.ReadFile(path)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if !bytes.Equal(after, damaged) {
+			t.Fatalf("byte %d: the bundle was modified", at)
+		}
+	}
+}
+
+func TestJournalTornTail(t *testing.T) {
+	path, data := writeTestJournal(t)
+
+	// Half of a new record made it to disk
+	torn, err := encodeEntry(append([]byte(nil), data...), entryRecord, 2, bytes.Repeat([]byte{0xdd}, 100))
+	if err != nil {
+		t.Fatal(err)
+	}
+	torn = torn[:len(data)+60]
+	if err = os.WriteFile(path, torn, 0o600); err != nil {
+		t.Fatal(err)
+	}
+
+	j, err := OpenJournal(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer j.Close()
+
+	if after, _ := os.ReadFile(path); !bytes.Equal(after, torn) {
+		t.Fatal("opening the bundle modified it")
+	}
+	if j.Size() != int64(len(data)) {
+		t.Fatalf("Size %d, want %d", j.Size(), len(data))
+	}
+	if _, err = j.Record(2); err == nil {
+		t.Fatal("the torn record was recovered")
+	}
+
+	if err = j.AppendRecord(2, bytes.Repeat([]byte{0xee}, 10)); err != nil {
+		t.Fatal(err)
+	}
+	if info, _ := os.Stat(path); info.Size() != j.Size() {
+		t.Fatalf("file is %d bytes after the append, journal %d", info.Size(), j.Size())
+	}
+
+	reopened, err := OpenJournal(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reopened.Close()
+	record, err := reopened.Record(2)
+	if err != nil || !bytes.Equal(record, bytes.Repeat([]byte{0xee}, 10)) {
+		t.Fatalf("Record(2) = %x, %v", record, err)
+	}
+}
+
+func TestJournalCompact(t *testing.T) {
+	path, _ := writeTestJournal(t)
+
+	j, err := OpenJournal(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer j.Close()
+
+	// Supersede a record and the ToC, which still lists 2 records
+	if err = j.AppendRecord(1, bytes.Repeat([]byte{0xdd}, 100)); err != nil {
+		t.Fatal(err)
+	}
+	toc := bytes.Repeat([]byte{0xcc}, 2*tkeyoath.TocRecordDescriptorSize+64)
+	toc[0] = 2 // descriptor count
+	if err = j.AppendToC(toc); err != nil {
+		t.Fatal(err)
+	}
+	before := j.Size()
+
+	if err = j.Compact(); err != nil {
+		t.Fatal(err)
+	}
+	if j.Size() >= before {
+		t.Errorf("compacted to %d bytes from %d", j.Size(), before)
+	}
+
+	reopened, err := OpenJournal(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reopened.Close()
+
+	want := 2*(entryHeaderLen+100+entryTrailerLen) + entryHeaderLen + len(toc) + entryTrailerLen
+	if reopened.Size() != int64(len(journalMagic)+want) {
+		t.Errorf("compacted bundle is %d bytes, want %d", reopened.Size(), len(journalMagic)+want)
+	}
+	if !bytes.Equal(reopened.ToC(), toc) {
+		t.Errorf("ToC %x, want %x", reopened.ToC(), toc)
+	}
+	for slot, b := range []byte{0xaa, 0xdd} {
+		record, err := reopened.Record(slot)
+		if err != nil || !bytes.Equal(record, bytes.Repeat([]byte{b}, 100)) {
+			t.Errorf("Record(%d) = %x, %v", slot, record, err)
+		}
+	}
+}
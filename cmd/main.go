@@ -4,13 +4,9 @@
 
 package main
 
-/*
-#include "c_shim.h"
-*/
-import "C"
-
 import (
 	_ "embed"
+	"encoding/json"
 	"errors"
 	"fmt"
 	"io"
@@ -18,9 +14,11 @@ import (
 	"os"
 	"os/signal"
 	"syscall"
-	
-	"github.com/spf13/pflag"
+	"time"
+
 	"github.com/nowitis/pattern/internal/util"
+	"github.com/nowitis/pattern/tkeyoath"
+	"github.com/spf13/pflag"
 	"github.com/tillitis/tkeyclient"
 )
 
@@ -39,11 +37,25 @@ const (
 
 var le = log.New(os.Stderr, "", 0)
 
+func init() {
+	tkeyoath.SetLogOutput(os.Stderr)
+}
+
 func main() {
 	var devPath string
 	var speed int
 	var otpBundlePath, createOtpBundlePath string
-	var helpOnly bool
+	var account string
+	var compact, memInfo, watch, helpOnly bool
+	var watchLead time.Duration
+	var benchSpec, benchOutPath string
+	var benchIterations int
+	var benchDuration time.Duration
+	var tracePath, recordPath, replayPath, replayOutPath string
+	var replayPaced bool
+	var appPath, migrateKeyPath, migrateExportPath, migrateOutPath, migrateTargetApp string
+	var migrateImport bool
+	var migrateBatch int
 	pflag.CommandLine.SortFlags = false
 	pflag.StringVar(&devPath, "port", "",
 		"Set serial port device `PATH`. If this is not passed, auto-detection will be attempted.")
@@ -53,6 +65,48 @@ func main() {
 		"The bundle containing encrypted OTP records.")
 	pflag.StringVar(&createOtpBundlePath, "create", "",
 		"The path where to create a new bundle.")
+	pflag.StringVar(&account, "account", "",
+		"Only show the codes of the records whose name starts with `PREFIX`.")
+	pflag.BoolVar(&watch, "watch", false,
+		"Keep the session open and output the code of each TOTP record of the --bundle as a JSON line whenever a new one becomes valid.")
+	pflag.DurationVar(&watchLead, "watch-lead", 2*time.Second,
+		"With --watch, ask the TKey for the next codes up to `DURATION` before they become valid.")
+	pflag.BoolVar(&compact, "compact", false,
+		"Compact the bundle given with --bundle, dropping superseded entries, and exit.")
+	pflag.StringVar(&appPath, "app", "",
+		"Load the device app from `PATH` instead of the embedded one, e.g. an earlier version to migrate from.")
+	pflag.StringVar(&migrateKeyPath, "migrate-key", "",
+		"Write the migration key of the running app to `PATH`, for --migrate-export, and exit.")
+	pflag.StringVar(&migrateExportPath, "migrate-export", "",
+		"Re-wrap the --bundle for the app whose migration key is in `PATH`, into --migrate-out.")
+	pflag.StringVar(&migrateTargetApp, "migrate-target-app", "",
+		"With --migrate-export, check that the migration key was published by the app binary at `PATH`.")
+	pflag.BoolVar(&migrateImport, "migrate-import", false,
+		"Re-wrap the exported --bundle for the running app, into --migrate-out.")
+	pflag.StringVar(&migrateOutPath, "migrate-out", "",
+		"The `PATH` of the bundle written by --migrate-export or --migrate-import.")
+	pflag.IntVar(&migrateBatch, "migrate-batch", 8,
+		"Number of re-wrapped records written to disk at once while migrating.")
+	pflag.BoolVar(&memInfo, "meminfo", false,
+		"Output the stack high-water mark and memory use of the device app as JSON, and exit.")
+	pflag.StringVar(&benchSpec, "bench", "",
+		"Run the comma-separated benchmark `WORKLOADS` (toc, put, totp, hotp, list, lookup, or all) instead of using a bundle.")
+	pflag.IntVar(&benchIterations, "bench-iterations", 100,
+		"Number of iterations of each benchmark workload.")
+	pflag.DurationVar(&benchDuration, "bench-duration", 0,
+		"Run each benchmark workload for `DURATION` instead of a number of iterations.")
+	pflag.StringVar(&benchOutPath, "bench-out", "-",
+		"Write the benchmark JSON report to `PATH` (- for stdout).")
+	pflag.StringVar(&tracePath, "trace", "",
+		"Write the timing of every frame exchanged with the app to `FILE`, in Chrome trace format (open it in ui.perfetto.dev or chrome://tracing).")
+	pflag.StringVar(&recordPath, "record", "",
+		"Log every frame exchanged with the app, with its timing, to `FILE`, for --replay.")
+	pflag.StringVar(&replayPath, "replay", "",
+		"Replay the session logged with --record in `FILE` against the app, report how the latency of each reply compares with the recording, and exit.")
+	pflag.BoolVar(&replayPaced, "replay-paced", false,
+		"With --replay, keep the pauses of the recording between a reply and the next frame, instead of replaying at full speed.")
+	pflag.StringVar(&replayOutPath, "replay-out", "-",
+		"Write the replay JSON report to `PATH` (- for stdout).")
 	pflag.BoolVar(&helpOnly, "help", false, "Output this help.")
 	pflag.Usage = func() {
 		fmt.Fprintf(os.Stderr, `runoath is a client app that allows to use the TKey as 
@@ -75,7 +129,44 @@ Usage:
 		os.Exit(0)
 	}
 
-	if (otpBundlePath == "") && (createOtpBundlePath == "") {
+	var benchWorkloads []string
+	if benchSpec != "" {
+		var err error
+		if benchWorkloads, err = parseBenchWorkloads(benchSpec); err != nil {
+			le.Printf("%v\n", err)
+			os.Exit(2)
+		}
+		if (otpBundlePath != "") || (createOtpBundlePath != "") {
+			le.Printf("--bench cannot be used together with --bundle or --create.\n")
+			os.Exit(2)
+		}
+		if (benchIterations <= 0) && (benchDuration <= 0) {
+			le.Printf("--bench needs a positive --bench-iterations or --bench-duration.\n")
+			os.Exit(2)
+		}
+	}
+
+	migrating := (migrateExportPath != "") || migrateImport
+	if migrating {
+		if (migrateExportPath != "") && migrateImport {
+			le.Printf("--migrate-export and --migrate-import cannot be used together.\n")
+			os.Exit(2)
+		}
+		if (otpBundlePath == "") || (migrateOutPath == "") {
+			le.Printf("Migrating needs the source bundle set with --bundle, and --migrate-out.\n")
+			os.Exit(2)
+		}
+		if migrateBatch <= 0 {
+			le.Printf("--migrate-batch must be positive.\n")
+			os.Exit(2)
+		}
+	}
+	if (migrateTargetApp != "") && (migrateExportPath == "") {
+		le.Printf("--migrate-target-app only applies to --migrate-export.\n")
+		os.Exit(2)
+	}
+
+	if (benchSpec == "") && !memInfo && (migrateKeyPath == "") && (otpBundlePath == "") && (createOtpBundlePath == "") {
 		le.Printf("Please set a OTP bundle path with --bundle, or use --create to generate a new one.\n")
 		pflag.Usage()
 		os.Exit(2)
@@ -87,6 +178,23 @@ Usage:
 		os.Exit(2)
 	}
 
+	if watch && ((otpBundlePath == "") || (watchLead <= 0)) {
+		le.Printf("--watch needs a bundle set with --bundle, and a positive --watch-lead.\n")
+		os.Exit(2)
+	}
+
+	if compact {
+		if otpBundlePath == "" {
+			le.Printf("--compact needs a bundle set with --bundle.\n")
+			os.Exit(2)
+		}
+		if err := compactBundle(otpBundlePath); err != nil {
+			le.Printf("Compaction failed: %v\n", err)
+			os.Exit(1)
+		}
+		os.Exit(0)
+	}
+
 	if devPath == "" {
 		var err error
 		devPath, err = util.DetectSerialPort(true)
@@ -104,21 +212,91 @@ Usage:
 		os.Exit(1)
 	}
 
-	deviceApp := New(tk)
+	// The connection in use: tkeyclient's until the app runs
+	var conn io.Closer = tk
+	var tracer *tkeyoath.Tracer
+	var recorder *tkeyoath.Recorder
 	exit := func(code int) {
-		if err := deviceApp.Close(); err != nil {
+		if err := conn.Close(); err != nil {
 			le.Printf("%v\n", err)
 		}
+		if err := tracer.Close(); err != nil {
+			le.Printf("Writing the trace failed: %v\n", err)
+		}
+		if err := recorder.Close(); err != nil {
+			le.Printf("Writing the session log failed: %v\n", err)
+		}
 		os.Exit(code)
 	}
 	handleSignals(func() { exit(1) }, os.Interrupt, syscall.SIGTERM)
 
+	appLoaded := false
 	if isFirmwareMode(tk) {
 		le.Printf("Device is in firmware mode. Loading app...\n")
+		start := time.Now()
+		if appPath != "" {
+			bin, err := os.ReadFile(appPath)
+			if err != nil {
+				le.Printf("%v\n", err)
+				exit(1)
+			}
+			appBinary = bin
+		}
 		if err := tk.LoadApp(appBinary, []byte{}); err != nil {
 			le.Printf("LoadApp failed: %v", err)
 			exit(1)
 		}
+		le.Printf("Loaded %d bytes app in %v\n", len(appBinary), time.Since(start))
+		appLoaded = true
+	}
+
+	// The app replies with frames of varying length, which tkeyclient
+	// does not read: talk to it over our own connection.
+	if err := tk.Close(); err != nil {
+		le.Printf("%v\n", err)
+		os.Exit(1)
+	}
+	appConn, err := tkeyoath.OpenConn(devPath, speed)
+	if err != nil {
+		le.Printf("Could not open %s: %v\n", devPath, err)
+		os.Exit(1)
+	}
+	conn = appConn
+	deviceApp := tkeyoath.New(appConn)
+
+	if tracePath != "" {
+		f, err := os.Create(tracePath)
+		if err != nil {
+			le.Printf("%v\n", err)
+			exit(1)
+		}
+		tracer = tkeyoath.NewTracer(f)
+		appConn.SetTracer(tracer)
+	}
+	if recordPath != "" {
+		f, err := os.Create(recordPath)
+		if err != nil {
+			le.Printf("%v\n", err)
+			exit(1)
+		}
+		recorder = tkeyoath.NewRecorder(f)
+		appConn.SetRecorder(recorder)
+	}
+
+	// A previous client may have left the app in the middle of a
+	// transfer, or of a frame. Another app is left alone.
+	if !appLoaded {
+		start := time.Now()
+		state, err := deviceApp.ResyncApp(isWantedNameVersion)
+		switch {
+		case errors.Is(err, tkeyoath.ErrOtherApp):
+			// reported below
+		case err != nil:
+			le.Printf("Resync failed: %v\n", err)
+		case state.Interrupted != 0 || state.Dropped != 0:
+			le.Printf("Resynced in %v: aborted command 0x%02x, the device dropped %d stale bytes\n",
+				time.Since(start).Round(time.Millisecond), state.Interrupted, state.Dropped)
+		}
 	}
 
 	if !isWantedApp(deviceApp) {
@@ -127,75 +305,266 @@ Usage:
 		exit(1)
 	}
 
-	var f *os.File
-	var err error
+	if replayPath != "" {
+		if err := replaySession(appConn, replayPath, replayPaced, devPath, speed, replayOutPath); err != nil {
+			le.Printf("Replay failed: %v\n", err)
+			exit(1)
+		}
+		exit(0)
+	}
+
+	if benchSpec != "" {
+		out := os.Stdout
+		if benchOutPath != "-" {
+			var err error
+			if out, err = os.Create(benchOutPath); err != nil {
+				le.Printf("%v\n", err)
+				exit(1)
+			}
+		}
+
+		report := benchReport{Port: devPath, Speed: speed}
+		cfg := benchConfig{
+			workloads:  benchWorkloads,
+			iterations: benchIterations,
+			duration:   benchDuration,
+		}
+		err := runBench(deviceApp, cfg, &report, out)
+		if out != os.Stdout {
+			out.Close()
+		}
+		if err != nil {
+			le.Printf("Benchmark failed: %v\n", err)
+			exit(1)
+		}
+		exit(0)
+	}
+
+	if memInfo {
+		if err := showMemInfo(deviceApp); err != nil {
+			le.Printf("Getting memory information failed: %v\n", err)
+			exit(1)
+		}
+		exit(0)
+	}
+
+	if migrateKeyPath != "" {
+		key, digest, err := deviceApp.GetMigrationKey()
+		if err == nil {
+			err = writeMigrationKey(migrateKeyPath, key, digest)
+		}
+		if err != nil {
+			le.Printf("Getting the migration key failed: %v\n", err)
+			exit(1)
+		}
+		le.Printf("Wrote the migration key of this app to %s\n", migrateKeyPath)
+		exit(0)
+	}
+
+	if migrating {
+		if err := migrate(deviceApp, otpBundlePath, migrateOutPath, migrateExportPath, migrateTargetApp, migrateBatch); err != nil {
+			le.Printf("Migration failed: %v\n", err)
+			exit(1)
+		}
+		exit(0)
+	}
 
-	if (otpBundlePath != "") {
-		f, err = os.Open(otpBundlePath)
+	var bundle *Journal
+	if otpBundlePath != "" {
+		bundle, err = OpenJournal(otpBundlePath)
 	} else {
-		f, err = os.Create(createOtpBundlePath)
+		bundle, err = CreateJournal(createOtpBundlePath)
+	}
+	if err != nil {
+		le.Printf("%v\n", err)
+		exit(1)
 	}
 
+	if createOtpBundlePath != "" {
+		err = createBundle(deviceApp, bundle)
+	} else if bundle.MigrationKey() != nil {
+		err = fmt.Errorf("%s was exported for another app version, import it with --migrate-import", otpBundlePath)
+	}
+	if err == nil && watch {
+		err = watchCodes(deviceApp, bundle, account, watchLead, os.Stdout)
+	} else if err == nil {
+		err = showCodes(deviceApp, bundle, account)
+	}
+	if cerr := bundle.Close(); cerr != nil && err == nil {
+		err = cerr
+	}
 	if err != nil {
 		le.Printf("%v\n", err)
 		exit(1)
 	}
-	defer f.Close()
 
+	exit(0)
+}
 
-	err = deviceApp.LoadToC(nil)
+// createBundle seals a first record on the device and writes it,
+// with the ToC listing it, to an empty bundle.
+func createBundle(deviceApp tkeyoath.App, bundle *Journal) error {
+	err := deviceApp.LoadToC(nil)
 	if err != nil {
-		le.Printf("LoadToC failed: %v", err)
-		exit(1)
+		return fmt.Errorf("LoadToC failed: %w", err)
 	}
 
-	recordBytes := makePutRequestTOTP("JBSWY3DPEHPK3PXP", "totp.danhersam.com", 30, true, 6)
+	recordBytes := tkeyoath.MakePutRequestTOTP("JBSWY3DPEHPK3PXP", "totp.danhersam.com", 30, true, 6)
 	err = deviceApp.PutRecord(recordBytes)
 	if err != nil {
-		le.Printf("PutRecord failed: %v", err)
-		exit(1)
+		return fmt.Errorf("PutRecord failed: %w", err)
 	}
-	
-	encryptedRecordByte, err := deviceApp.GetPutResult((int)(C.secure_oath_record_packed_size()))
+
+	encryptedRecordByte, err := deviceApp.GetPutResult(tkeyoath.SecureOathRecordSize)
 	if err != nil {
-		le.Printf("GetPutResult failed: %v", err)
-		exit(1)
+		return fmt.Errorf("GetPutResult failed: %w", err)
 	}
 
-	calculateRequest := makeCalculateRequest(encryptedRecordByte)
-	calculated, err := deviceApp.Calculate(calculateRequest)
+	encToC, err := deviceApp.GetEncryptedToC()
 	if err != nil {
-		le.Printf("Calculate failed: %v", err)
-		exit(1)
+		return fmt.Errorf("GetEncryptedToC failed: %w", err)
 	}
-	le.Printf("%i", calculated)
 
-	encToC, err := deviceApp.GetEncryptedToC()
+	// Record first: a crash before the ToC lands leaves a record the
+	// recovered ToC does not list yet, which is harmless.
+	if err = bundle.AppendRecord(0, encryptedRecordByte); err != nil {
+		return fmt.Errorf("AppendRecord failed: %w", err)
+	}
+	if err = bundle.AppendToC(encToC); err != nil {
+		return fmt.Errorf("AppendToC failed: %w", err)
+	}
+
+	return nil
+}
+
+// showCodes loads the bundle's ToC on the device and prints the
+// current code of every record whose name starts with account. HOTP records come back re-sealed with
+// the bumped counter and are appended to the bundle.
+func showCodes(deviceApp tkeyoath.App, bundle *Journal, account string) error {
+	err := deviceApp.LoadToC(bundle.ToC())
 	if err != nil {
-		le.Printf("GetEncryptedToC failed: %v", err)
-		exit(1)
+		return fmt.Errorf("LoadToC failed: %w", err)
 	}
-	le.Printf("%i", len(encToC))
 
-	err = deviceApp.LoadToC(encToC)
+	if bundle.RecordCount() == 0 {
+		le.Printf("The bundle holds no records.\n")
+		return nil
+	}
+
+	entries, err := deviceApp.ListNames(account)
 	if err != nil {
-		le.Printf("LoadToC failed: %v", err)
-		exit(1)
+		return fmt.Errorf("ListNames failed: %w", err)
 	}
-	
-	listBytes, err := deviceApp.GetList()
+	if len(entries) == 0 {
+		le.Printf("No record matches %q.\n", account)
+	}
+
+	for _, entry := range entries {
+		slot, name := entry.Slot, entry.Name
+		if slot >= bundle.RecordCount() {
+			return fmt.Errorf("device lists slot %d, bundle has %d records", slot, bundle.RecordCount())
+		}
+
+		record, err := bundle.Record(slot)
+		if err != nil {
+			return fmt.Errorf("%s: %w", name, err)
+		}
+
+		code, resealed, err := deviceApp.Calculate(tkeyoath.MakeCalculateRequest(record))
+		if err != nil {
+			return fmt.Errorf("Calculate failed: %w", err)
+		}
+
+		if resealed != nil {
+			if err = bundle.AppendRecord(slot, resealed); err != nil {
+				return fmt.Errorf("AppendRecord failed: %w", err)
+			}
+		}
+
+		fmt.Printf("%s: %0*d\n", name, tkeyoath.RecordDigits(record), code)
+	}
+
+	return nil
+}
+
+// migrate exports the bundle at srcPath for the app whose key is in
+// targetKeyPath or, if that is empty, imports it for the running app.
+// If targetAppPath is set, the key must be that binary's.
+func migrate(deviceApp tkeyoath.App, srcPath, dstPath, targetKeyPath, targetAppPath string, batch int) error {
+	var targetKey, targetDigest []byte
+	if targetKeyPath != "" {
+		var err error
+		if targetKey, targetDigest, err = readMigrationKey(targetKeyPath); err != nil {
+			return err
+		}
+		if targetAppPath != "" {
+			if err = checkTargetApp(targetAppPath, targetDigest); err != nil {
+				return err
+			}
+		}
+	}
+
+	src, err := OpenJournal(srcPath)
 	if err != nil {
-		le.Printf("GetList failed: %v", err)
-		exit(1)
+		return err
 	}
-	le.Printf("%i", len(listBytes))
-	name := listBytes[1:1+listBytes[0]]
-	le.Printf("%s", name)
+	defer src.Close()
 
-	f.Write(encToC)
-	f.Write(encryptedRecordByte)
+	dst, err := CreateJournal(dstPath)
+	if err != nil {
+		return err
+	}
+	defer dst.Close()
 
-	exit(0)
+	var stats migrateStats
+	if targetKey != nil {
+		stats, err = exportBundle(deviceApp, src, dst, targetKey, targetDigest, batch)
+	} else {
+		stats, err = importBundle(deviceApp, src, dst, batch)
+	}
+	if err != nil {
+		os.Remove(dstPath)
+		return err
+	}
+	le.Printf("Migrated %s to %s: %v\n", srcPath, dstPath, stats)
+
+	return nil
+}
+
+func showMemInfo(deviceApp tkeyoath.App) error {
+	info, err := deviceApp.GetMemInfo()
+	if err != nil {
+		return err
+	}
+
+	if info.TocDescriptorsMaxCount != tkeyoath.TocDescriptorsMaxCount || info.RecordNameMaxLen != tkeyoath.RecordNameMaxLen {
+		le.Printf("The device app was built with a different capacity profile than this client (%s).\n",
+			tkeyoath.CapacityProfile)
+	}
+
+	enc := json.NewEncoder(os.Stdout)
+	enc.SetIndent("", "  ")
+	if err = enc.Encode(info); err != nil {
+		return fmt.Errorf("Encode: %w", err)
+	}
+
+	return nil
+}
+
+func compactBundle(path string) error {
+	bundle, err := OpenJournal(path)
+	if err != nil {
+		return err
+	}
+	defer bundle.Close()
+
+	before := bundle.Size()
+	if err = bundle.Compact(); err != nil {
+		return err
+	}
+	le.Printf("Compacted %s from %d to %d bytes\n", path, before, bundle.Size())
+
+	return nil
 }
 
 func handleSignals(action func(), sig ...os.Signal) {
@@ -222,7 +591,7 @@ func isFirmwareMode(tk *tkeyclient.TillitisKey) bool {
 		nameVer.Name1 == wantFWName1
 }
 
-func isWantedApp(deviceApp OathApp) bool {
+func isWantedApp(deviceApp tkeyoath.App) bool {
 	nameVer, err := deviceApp.GetAppNameVersion()
 	if err != nil {
 		if !errors.Is(err, io.EOF) {
@@ -230,6 +599,11 @@ func isWantedApp(deviceApp OathApp) bool {
 		}
 		return false
 	}
+
+	return isWantedNameVersion(nameVer)
+}
+
+func isWantedNameVersion(nameVer *tkeyclient.NameVersion) bool {
 	// not caring about nameVer.Version
 	return nameVer.Name0 == wantAppName0 &&
 		nameVer.Name1 == wantAppName1
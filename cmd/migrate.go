@@ -0,0 +1,238 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"bytes"
+	"encoding/hex"
+	"fmt"
+	"os"
+	"strings"
+	"time"
+
+	"github.com/nowitis/pattern/tkeyoath"
+	"golang.org/x/crypto/blake2s"
+)
+
+// Bundles are sealed with the CDI, which changes with every app
+// binary. Migrating a bundle to another app version is done in three
+// steps, each with the TKey freshly plugged in:
+//
+//  1. the target app publishes its migration key, and the digest of
+//     its binary as it measured it (--migrate-key);
+//  2. the current app re-wraps the bundle for that key and digest
+//     (--migrate-export), after two touches;
+//  3. the target app re-wraps the exported bundle for its own CDI
+//     (--migrate-import).
+//
+// Records stream from the source bundle through the device to the
+// destination bundle, which is synced once per batch.
+
+type migrateStats struct {
+	records int
+	bytes   int
+	elapsed time.Duration
+}
+
+func (s migrateStats) String() string {
+	secs := s.elapsed.Seconds()
+	if secs == 0 {
+		return fmt.Sprintf("%d records, %d bytes", s.records, s.bytes)
+	}
+
+	return fmt.Sprintf("%d records, %d bytes in %v (%.1f records/s, %.0f B/s)",
+		s.records, s.bytes, s.elapsed.Round(time.Millisecond),
+		float64(s.records)/secs, float64(s.bytes)/secs)
+}
+
+// A migration key file holds the key, then the app digest, each on a
+// line in hex.
+func writeMigrationKey(path string, key, digest []byte) error {
+	text := hex.EncodeToString(key) + "\n" + hex.EncodeToString(digest) + "\n"
+
+	return os.WriteFile(path, []byte(text), 0o644) // nolint:gosec // public key
+}
+
+func readMigrationKey(path string) ([]byte, []byte, error) {
+	raw, err := os.ReadFile(path)
+	if err != nil {
+		return nil, nil, fmt.Errorf("ReadFile: %w", err)
+	}
+
+	lines := strings.Fields(string(raw))
+	if len(lines) != 2 {
+		return nil, nil, fmt.Errorf("%s: not a migration key", path)
+	}
+	key, err := hex.DecodeString(lines[0])
+	if err != nil || len(key) != tkeyoath.MigrateKeyLen {
+		return nil, nil, fmt.Errorf("%s: not a migration key", path)
+	}
+	digest, err := hex.DecodeString(lines[1])
+	if err != nil || len(digest) != tkeyoath.MigrateDigestLen {
+		return nil, nil, fmt.Errorf("%s: not a migration key", path)
+	}
+
+	return key, digest, nil
+}
+
+// checkTargetApp checks that the digest in a migration key file is the
+// one of the app binary at path, as the firmware measures it.
+func checkTargetApp(path string, digest []byte) error {
+	bin, err := os.ReadFile(path)
+	if err != nil {
+		return fmt.Errorf("ReadFile: %w", err)
+	}
+
+	sum := blake2s.Sum256(bin)
+	if !bytes.Equal(sum[:], digest) {
+		return fmt.Errorf("the migration key is not for %s: its app digest is %x, the binary's %x",
+			path, digest, sum)
+	}
+
+	return nil
+}
+
+// exportBundle re-wraps src for the app whose migration key is
+// targetKey and binary digest targetDigest, into the new bundle dst.
+func exportBundle(app tkeyoath.App, src, dst *Journal, targetKey, targetDigest []byte, batch int) (migrateStats, error) {
+	if src.MigrationKey() != nil {
+		return migrateStats{}, fmt.Errorf("bundle is already exported, import it first")
+	}
+
+	le.Printf("Exporting for the app with digest %x\n", targetDigest)
+	le.Printf("Touch the TKey twice, while its LED alternates red and blue, to confirm the export...\n")
+	ephemeralKey, err := app.StartMigration(tkeyoath.MigrateModeExport, targetKey, targetDigest)
+	if err != nil {
+		return migrateStats{}, fmt.Errorf("StartMigration: %w", err)
+	}
+	if err = dst.AppendMigrationKey(ephemeralKey); err != nil {
+		return migrateStats{}, err
+	}
+
+	return rewrapBundle(app, src, dst, batch)
+}
+
+// importBundle re-wraps an exported bundle src for the running app,
+// into the new bundle dst.
+func importBundle(app tkeyoath.App, src, dst *Journal, batch int) (migrateStats, error) {
+	if src.MigrationKey() == nil {
+		return migrateStats{}, fmt.Errorf("bundle was not exported with --migrate-export")
+	}
+
+	if _, err := app.StartMigration(tkeyoath.MigrateModeImport, src.MigrationKey(), nil); err != nil {
+		return migrateStats{}, fmt.Errorf("StartMigration: %w", err)
+	}
+
+	stats, err := rewrapBundle(app, src, dst, batch)
+	if (err != nil) && (stats.records == 0) {
+		err = fmt.Errorf("%w (was the bundle exported for this app binary?)", err)
+	}
+
+	return stats, err
+}
+
+type rewrapJob struct {
+	slot   int
+	record []byte
+	err    error
+}
+
+// rewrapBundle runs the pipeline once the migration has started: a
+// reader goroutine streams records off disk, the device re-wraps them
+// one frame each, and a writer goroutine appends them to dst in
+// batches. The ToC goes last, as exporting it ends the session.
+func rewrapBundle(app tkeyoath.App, src, dst *Journal, batch int) (migrateStats, error) {
+	var stats migrateStats
+	start := time.Now()
+
+	count := src.RecordCount()
+	if count == 0 {
+		return stats, fmt.Errorf("the bundle holds no records")
+	}
+
+	if err := app.LoadToC(src.ToC()); err != nil {
+		return stats, fmt.Errorf("LoadToC: %w", err)
+	}
+
+	toDevice := make(chan rewrapJob, batch)
+	toDisk := make(chan []rewrapJob, 1)
+	written := make(chan error, 1)
+	stop := make(chan struct{})
+	defer close(stop)
+
+	go func() {
+		defer close(toDevice)
+		for slot := 0; slot < count; slot++ {
+			record, err := src.Record(slot)
+			select {
+			case toDevice <- rewrapJob{slot, record, err}:
+			case <-stop:
+				return
+			}
+			if err != nil {
+				return
+			}
+		}
+	}()
+
+	go func() {
+		var err error
+		for jobs := range toDisk {
+			if err != nil {
+				continue
+			}
+			slots := make([]int, len(jobs))
+			records := make([][]byte, len(jobs))
+			for i, job := range jobs {
+				slots[i] = job.slot
+				records[i] = job.record
+			}
+			err = dst.AppendRecords(slots, records)
+		}
+		written <- err
+	}()
+
+	var err error
+	pending := make([]rewrapJob, 0, batch)
+	for job := range toDevice {
+		if job.err != nil {
+			err = job.err
+			break
+		}
+		if job.record, err = app.Rewrap(job.record); err != nil {
+			err = fmt.Errorf("Rewrap slot %d: %w", job.slot, err)
+			break
+		}
+		stats.records++
+		stats.bytes += len(job.record)
+
+		pending = append(pending, job)
+		if len(pending) == batch {
+			toDisk <- pending
+			pending = make([]rewrapJob, 0, batch)
+		}
+	}
+	if len(pending) > 0 && err == nil {
+		toDisk <- pending
+	}
+	close(toDisk)
+	if werr := <-written; err == nil {
+		err = werr
+	}
+	if err != nil {
+		return stats, err
+	}
+
+	toc, err := app.GetEncryptedToC()
+	if err != nil {
+		return stats, fmt.Errorf("GetEncryptedToC: %w", err)
+	}
+	if err = dst.AppendToC(toc); err != nil {
+		return stats, err
+	}
+	stats.bytes += len(toc)
+	stats.elapsed = time.Since(start)
+
+	return stats, nil
+}
@@ -0,0 +1,187 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"time"
+
+	"github.com/nowitis/pattern/tkeyoath"
+)
+
+// Replay drives the frames of a session log recorded with --record
+// against a port, and compares the latency of each reply, from the
+// end of the write before it to its first byte, with the recording.
+// The replies are not compared byte for byte, as they hold fresh
+// nonces and codes, only their frame header and response code: a
+// session replays as recorded only against the same app binary, on a
+// TKey or QEMU with the same UDS, and without touch.
+
+// replayReadTimeout is how long, in seconds, to wait for a reply
+// before considering the rest of the session lost.
+const replayReadTimeout = 5
+
+type replayFrame struct {
+	Entry              int    `json:"entry"`
+	Code               string `json:"code"`
+	RecordedNs         int64  `json:"recorded_ns"`
+	ReplayedNs         int64  `json:"replayed_ns"`
+	DeltaNs            int64  `json:"delta_ns"`
+	RecordedTransferNs int64  `json:"recorded_transfer_ns"`
+	ReplayedTransferNs int64  `json:"replayed_transfer_ns"`
+	// Mismatch is set when the reply has another frame header or
+	// response code than the recorded one.
+	Mismatch bool `json:"mismatch,omitempty"`
+}
+
+type replayReport struct {
+	Log        string        `json:"log"`
+	Port       string        `json:"port"`
+	Speed      int           `json:"speed"`
+	Paced      bool          `json:"paced"`
+	Started    time.Time     `json:"started"`
+	Frames     int           `json:"frames"`
+	Mismatches int           `json:"mismatches"`
+	Missing    int           `json:"missing"` // replies recorded but not received
+	RecordedNs int64         `json:"recorded_ns"`
+	ReplayedNs int64         `json:"replayed_ns"`
+	Recorded   benchLatency  `json:"recorded_latency"`
+	Replayed   benchLatency  `json:"replayed_latency"`
+	Delta      benchLatency  `json:"delta_latency"`
+	Details    []replayFrame `json:"details"`
+}
+
+// replaySession replays the session logged in logPath on conn, and
+// writes the report to outPath (- for stdout).
+func replaySession(conn *tkeyoath.Conn, logPath string, paced bool, port string, speed int, outPath string) error {
+	f, err := os.Open(logPath)
+	if err != nil {
+		return err
+	}
+	entries, err := tkeyoath.ReadSessionLog(f)
+	f.Close()
+	if err != nil {
+		return fmt.Errorf("%s: %w", logPath, err)
+	}
+
+	out := os.Stdout
+	if outPath != "-" {
+		if out, err = os.Create(outPath); err != nil {
+			return err
+		}
+		defer out.Close()
+	}
+
+	report := replayReport{Log: logPath, Port: port, Speed: speed}
+	return runReplay(conn, entries, paced, &report, out)
+}
+
+// runReplay replays entries on conn, writing as fast as the replies
+// come, or, if paced, keeping the gaps of the recording between a
+// reply and the next write.
+func runReplay(conn *tkeyoath.Conn, entries []tkeyoath.SessionEntry, paced bool, report *replayReport, out io.Writer) error {
+	report.Paced = paced
+	report.Started = time.Now().UTC()
+
+	if err := conn.SetReadTimeout(replayReadTimeout); err != nil {
+		return err
+	}
+
+	var recorded, replayed, deltas []time.Duration
+	var lastWriteOrig, prevOrig time.Duration
+	var lastWrite, prev time.Time
+	start := time.Now()
+
+	for i, e := range entries {
+		if paced && !prev.IsZero() && e.Kind != tkeyoath.SessionRead {
+			time.Sleep(time.Until(prev.Add(e.At - prevOrig)))
+		}
+
+		switch e.Kind {
+		case tkeyoath.SessionWrite:
+			if err := conn.Write(e.Data); err != nil {
+				return fmt.Errorf("entry %d: %w", i, err)
+			}
+			lastWriteOrig, lastWrite = e.At, time.Now()
+			prevOrig, prev = lastWriteOrig, lastWrite
+			continue
+
+		case tkeyoath.SessionDrain:
+			// The device discards what it receives until the line is
+			// quiet, e.g. after resync filler: wait as the client did
+			if _, err := conn.Drain(e.Quiet); err != nil {
+				return fmt.Errorf("entry %d: %w", i, err)
+			}
+			if err := conn.SetReadTimeout(replayReadTimeout); err != nil {
+				return err
+			}
+			prevOrig, prev = e.At+e.Transfer, time.Now()
+			continue
+		}
+
+		frame, firstByte, err := conn.ReadRawFrame()
+		if err != nil {
+			for _, rest := range entries[i:] {
+				if rest.Kind == tkeyoath.SessionRead {
+					report.Missing++
+				}
+			}
+			le.Printf("Entry %d: %v, giving up on the %d replies left\n", i, err, report.Missing)
+			break
+		}
+		done := time.Now()
+
+		f := replayFrame{
+			Entry:              i,
+			RecordedNs:         (e.At - lastWriteOrig).Nanoseconds(),
+			ReplayedNs:         firstByte.Sub(lastWrite).Nanoseconds(),
+			RecordedTransferNs: e.Transfer.Nanoseconds(),
+			ReplayedTransferNs: done.Sub(firstByte).Nanoseconds(),
+		}
+		if len(e.Data) > 1 {
+			f.Code = fmt.Sprintf("0x%02x", e.Data[1])
+		}
+		f.DeltaNs = f.ReplayedNs - f.RecordedNs
+		if len(frame) != len(e.Data) || frame[0] != e.Data[0] ||
+			(len(frame) > 1 && frame[1] != e.Data[1]) {
+			f.Mismatch = true
+			report.Mismatches++
+		}
+		report.Details = append(report.Details, f)
+
+		recorded = append(recorded, time.Duration(f.RecordedNs))
+		replayed = append(replayed, time.Duration(f.ReplayedNs))
+		deltas = append(deltas, time.Duration(f.DeltaNs))
+		prevOrig, prev = e.At+e.Transfer, done
+	}
+
+	if len(entries) > 0 {
+		last := entries[len(entries)-1]
+		report.RecordedNs = (last.At + last.Transfer).Nanoseconds()
+	}
+	report.ReplayedNs = time.Since(start).Nanoseconds()
+	report.Frames = len(report.Details)
+	report.Recorded, _ = summarizeLatency(recorded)
+	report.Replayed, _ = summarizeLatency(replayed)
+	report.Delta, _ = summarizeLatency(deltas)
+
+	if err := conn.SetReadTimeout(0); err != nil {
+		return err
+	}
+
+	enc := json.NewEncoder(out)
+	enc.SetIndent("", "  ")
+	if err := enc.Encode(report); err != nil {
+		return fmt.Errorf("Encode: %w", err)
+	}
+
+	if report.Missing > 0 || report.Mismatches > 0 {
+		return fmt.Errorf("%d replies missing, %d differing from the recording", report.Missing, report.Mismatches)
+	}
+
+	return nil
+}
@@ -0,0 +1,225 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"sort"
+	"time"
+
+	"github.com/nowitis/pattern/tkeyoath"
+)
+
+// Watch mode keeps one session open and computes each TOTP code once
+// per period. The code for the next period is asked for ahead of the
+// boundary, with the boundary as the time, and written out when it
+// becomes valid. Accounts are spread evenly across the lead window, so
+// the device handles one request at a time and the load does not
+// depend on how often the output is read.
+
+// watchMaxFailures is how many calculations in a row may fail before
+// watch mode gives up on the session.
+const watchMaxFailures = 3
+
+type watchCode struct {
+	Name       string  `json:"name"`
+	Slot       int     `json:"slot"`
+	Code       string  `json:"code"`
+	Period     int     `json:"period"`
+	ValidFrom  int64   `json:"valid_from"`
+	ValidUntil int64   `json:"valid_until"`
+	Remaining  float64 `json:"remaining_s"`
+}
+
+type watchAccount struct {
+	name     string
+	slot     int
+	record   []byte
+	period   time.Duration
+	digits   int
+	boundary time.Time // start of the period of the pending code
+	pending  string
+	lead     time.Duration // how long before boundary to ask for it
+	callAt   time.Time     // when to ask for the next code
+}
+
+// watchCodes streams the codes of the bundle's TOTP records matching
+// account as JSON lines to out, until the session fails. HOTP records
+// are skipped, as every calculation would bump their counter.
+func watchCodes(deviceApp tkeyoath.App, bundle *Journal, account string, lead time.Duration, out io.Writer) error {
+	if err := deviceApp.LoadToC(bundle.ToC()); err != nil {
+		return fmt.Errorf("LoadToC failed: %w", err)
+	}
+
+	entries, err := deviceApp.ListNames(account)
+	if err != nil {
+		return fmt.Errorf("ListNames failed: %w", err)
+	}
+
+	records := make([][]byte, len(entries))
+	for i, entry := range entries {
+		if records[i], err = bundle.Record(entry.Slot); err != nil {
+			return fmt.Errorf("%s: %w", entry.Name, err)
+		}
+	}
+	accounts, skipped, err := newWatchAccounts(entries, records)
+	for _, name := range skipped {
+		le.Printf("Skipping HOTP record %s.\n", name)
+	}
+	if err != nil {
+		return err
+	}
+	if len(accounts) == 0 {
+		return fmt.Errorf("no TOTP record matches %q", account)
+	}
+
+	enc := json.NewEncoder(out)
+	failures := 0
+	calculate := func(a *watchAccount, at time.Time) bool {
+		code, _, err := deviceApp.Calculate(tkeyoath.MakeCalculateRequestAt(a.record, at))
+		if err != nil {
+			le.Printf("%s: Calculate failed: %v\n", a.name, err)
+			failures++
+			return false
+		}
+		failures = 0
+		a.pending = fmt.Sprintf("%0*d", a.digits, code)
+		return true
+	}
+	emit := func(a *watchAccount) error {
+		now := time.Now()
+		until := a.boundary.Add(a.period)
+		return enc.Encode(watchCode{
+			Name:       a.name,
+			Slot:       a.slot,
+			Code:       a.pending,
+			Period:     int(a.period / time.Second),
+			ValidFrom:  a.boundary.Unix(),
+			ValidUntil: until.Unix(),
+			Remaining:  until.Sub(now).Round(time.Millisecond).Seconds(),
+		})
+	}
+
+	// Current codes first, then the first code of each next period.
+	now := time.Now()
+	for _, a := range accounts {
+		a.boundary = periodStart(now, a.period)
+		if calculate(a, now) {
+			if err = emit(a); err != nil {
+				return err
+			}
+		}
+		a.pending = ""
+	}
+	scheduleWatch(accounts, now, lead)
+
+	for failures < watchMaxFailures {
+		next := accounts[0]
+		for _, a := range accounts[1:] {
+			if watchEventAt(a).Before(watchEventAt(next)) {
+				next = a
+			}
+		}
+		time.Sleep(time.Until(watchEventAt(next)))
+
+		if next.pending == "" {
+			if !calculate(next, next.boundary) {
+				// Give up on this period, try again for the next one.
+				next.advance()
+			}
+			continue
+		}
+
+		if err = emit(next); err != nil {
+			return err
+		}
+		next.pending = ""
+		next.advance()
+	}
+
+	return fmt.Errorf("%d calculations failed in a row", failures)
+}
+
+// watchEventAt is when an account next needs attention: asking the
+// device for its next code, or writing out the code it got.
+func watchEventAt(a *watchAccount) time.Time {
+	if a.pending == "" {
+		return a.callAt
+	}
+
+	return a.boundary
+}
+
+// newWatchAccounts returns the accounts to watch for entries, whose
+// sealed records are records, and the names of the HOTP records left
+// out.
+func newWatchAccounts(entries []tkeyoath.ListEntry, records [][]byte) ([]*watchAccount, []string, error) {
+	var accounts []*watchAccount
+	var skipped []string
+	for i, entry := range entries {
+		record := records[i]
+		if tkeyoath.IsHOTPRecord(record) {
+			skipped = append(skipped, entry.Name)
+			continue
+		}
+		if tkeyoath.RecordTimestep(record) <= 0 {
+			return nil, skipped, fmt.Errorf("%s: invalid timestep %d", entry.Name, tkeyoath.RecordTimestep(record))
+		}
+		accounts = append(accounts, &watchAccount{
+			name:   entry.Name,
+			slot:   entry.Slot,
+			record: record,
+			period: time.Duration(tkeyoath.RecordTimestep(record)) * time.Second,
+			digits: tkeyoath.RecordDigits(record),
+		})
+	}
+
+	return accounts, skipped, nil
+}
+
+// periodStart is the start of the period of length period that t is
+// in. A period starts at its boundary, and ends just before the next.
+func periodStart(t time.Time, period time.Duration) time.Time {
+	seconds := int64(period / time.Second)
+
+	return time.Unix(t.Unix()/seconds*seconds, 0)
+}
+
+// scheduleWatch sets the boundary of every account to the end of the
+// period current at now, and when to ask for the code starting there.
+// The accounts are spread evenly, in slot order, across the lead
+// window before their boundaries, so that accounts whose periods end
+// together, even with different timesteps, do not ask at the same
+// time. The window is at most the shortest period.
+func scheduleWatch(accounts []*watchAccount, now time.Time, lead time.Duration) {
+	if len(accounts) == 0 {
+		return
+	}
+
+	sorted := append([]*watchAccount(nil), accounts...)
+	sort.Slice(sorted, func(i, j int) bool { return sorted[i].slot < sorted[j].slot })
+
+	window := lead
+	for _, a := range sorted {
+		if window > a.period {
+			window = a.period
+		}
+	}
+	step := window / time.Duration(len(sorted))
+
+	for i, a := range sorted {
+		a.boundary = periodStart(now, a.period).Add(a.period)
+		a.lead = window - time.Duration(i)*step
+		a.callAt = a.boundary.Add(-a.lead)
+	}
+}
+
+// advance moves a on to the next period, once its code was written out
+// or could not be had.
+func (a *watchAccount) advance() {
+	a.boundary = a.boundary.Add(a.period)
+	a.callAt = a.boundary.Add(-a.lead)
+}
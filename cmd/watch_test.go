@@ -0,0 +1,156 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package main
+
+import (
+	"testing"
+	"time"
+
+	"github.com/nowitis/pattern/tkeyoath"
+)
+
+// watchBase is a boundary of the 10, 30 and 60 s periods.
+var watchBase = time.Unix(1_700_000_040, 0)
+
+func TestWatchAccounts(t *testing.T) {
+	const secret = "JBSWY3DPEHPK3PXP"
+
+	// A PUT request starts with the record as sealed, whose protected
+	// part is in the clear
+	entries := []tkeyoath.ListEntry{{Slot: 0, Name: "totp30"}, {Slot: 1, Name: "hotp"}, {Slot: 2, Name: "totp60"}}
+	records := [][]byte{
+		tkeyoath.MakePutRequestTOTP(secret, "totp30", 30, false, 6),
+		tkeyoath.MakePutRequestHOTP(secret, "hotp", 5, false, 6),
+		tkeyoath.MakePutRequestTOTP(secret, "totp60", 60, false, 8),
+	}
+
+	accounts, skipped, err := newWatchAccounts(entries, records)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(skipped) != 1 || skipped[0] != "hotp" {
+		t.Errorf("skipped %q, want the HOTP record", skipped)
+	}
+	if len(accounts) != 2 {
+		t.Fatalf("%d accounts, want 2", len(accounts))
+	}
+	for i, want := range []struct {
+		slot   int
+		period time.Duration
+		digits int
+	}{{0, 30 * time.Second, 6}, {2, 60 * time.Second, 8}} {
+		a := accounts[i]
+		if a.slot != want.slot || a.period != want.period || a.digits != want.digits {
+			t.Errorf("account %d: slot %d, period %v, %d digits, want %+v", i, a.slot, a.period, a.digits, want)
+		}
+	}
+
+	records[2] = tkeyoath.MakePutRequestTOTP(secret, "totp0", 0, false, 6)
+	if _, _, err = newWatchAccounts(entries, records); err == nil {
+		t.Error("a record with no timestep was accepted")
+	}
+}
+
+func TestPeriodStart(t *testing.T) {
+	for _, c := range []struct {
+		name   string
+		t      time.Time
+		period time.Duration
+		want   time.Time
+	}{
+		{"at the boundary", watchBase, 30 * time.Second, watchBase},
+		{"just before it", watchBase.Add(-time.Nanosecond), 30 * time.Second, watchBase.Add(-30 * time.Second)},
+		{"just after it", watchBase.Add(time.Nanosecond), 30 * time.Second, watchBase},
+		{"within the period", watchBase.Add(29 * time.Second), 30 * time.Second, watchBase},
+		{"another timestep", watchBase.Add(-10 * time.Second), 60 * time.Second, watchBase.Add(-60 * time.Second)},
+	} {
+		if got := periodStart(c.t, c.period); !got.Equal(c.want) {
+			t.Errorf("%s: %v, want %v", c.name, got, c.want)
+		}
+	}
+}
+
+func TestScheduleWatch(t *testing.T) {
+	type want struct {
+		boundary time.Duration // from watchBase
+		callAt   time.Duration
+	}
+	for _, c := range []struct {
+		name    string
+		periods []time.Duration // by slot
+		now     time.Time
+		lead    time.Duration
+		want    []want
+	}{
+		{
+			name:    "at a period change",
+			periods: []time.Duration{30 * time.Second, 60 * time.Second, 30 * time.Second},
+			now:     watchBase,
+			lead:    3 * time.Second,
+			want:    []want{{30 * time.Second, 27 * time.Second}, {60 * time.Second, 58 * time.Second}, {30 * time.Second, 29 * time.Second}},
+		},
+		{
+			name:    "just before a period change",
+			periods: []time.Duration{30 * time.Second, 60 * time.Second, 30 * time.Second},
+			now:     watchBase.Add(-time.Nanosecond),
+			lead:    3 * time.Second,
+			want:    []want{{0, -3 * time.Second}, {0, -2 * time.Second}, {0, -time.Second}},
+		},
+		{
+			name:    "lead longer than the shortest period",
+			periods: []time.Duration{10 * time.Second, 60 * time.Second},
+			now:     watchBase.Add(5 * time.Second),
+			lead:    time.Minute,
+			want:    []want{{10 * time.Second, 0}, {60 * time.Second, 55 * time.Second}},
+		},
+	} {
+		accounts := make([]*watchAccount, len(c.periods))
+		for slot, period := range c.periods {
+			accounts[slot] = &watchAccount{slot: slot, period: period}
+		}
+		// The schedule follows the slots, not the order of accounts
+		accounts[0], accounts[len(accounts)-1] = accounts[len(accounts)-1], accounts[0]
+
+		scheduleWatch(accounts, c.now, c.lead)
+
+		for _, a := range accounts {
+			w := c.want[a.slot]
+			if !a.boundary.Equal(watchBase.Add(w.boundary)) || !a.callAt.Equal(watchBase.Add(w.callAt)) {
+				t.Errorf("%s: slot %d: boundary %v, asking at %v, want %v and %v", c.name, a.slot,
+					a.boundary.Sub(watchBase), a.callAt.Sub(watchBase), w.boundary, w.callAt)
+			}
+			if a.callAt.After(a.boundary) || a.boundary.Sub(a.callAt) > a.period {
+				t.Errorf("%s: slot %d asks %v before its boundary, period %v", c.name, a.slot, a.boundary.Sub(a.callAt), a.period)
+			}
+		}
+	}
+}
+
+func TestScheduleWatchSpreadsRequests(t *testing.T) {
+	periods := []time.Duration{30 * time.Second, 60 * time.Second, 30 * time.Second, 60 * time.Second, 90 * time.Second}
+	accounts := make([]*watchAccount, len(periods))
+	for slot, period := range periods {
+		accounts[slot] = &watchAccount{slot: slot, period: period}
+	}
+	scheduleWatch(accounts, watchBase, 2*time.Second)
+
+	// Over a few minutes, no two accounts ask for a code at the same
+	// time, even at the boundaries their periods share, and each asks
+	// once per period
+	end := watchBase.Add(5 * time.Minute)
+	asked := map[time.Time]int{}
+	for _, a := range accounts {
+		calls := 0
+		for ; a.callAt.Before(end); a.advance() {
+			if other, ok := asked[a.callAt]; ok {
+				t.Errorf("slots %d and %d both ask at %v", other, a.slot, a.callAt.Sub(watchBase))
+			}
+			asked[a.callAt] = a.slot
+			calls++
+		}
+		if want := int(end.Sub(watchBase) / a.period); calls != want {
+			t.Errorf("slot %d asked %d times, want %d", a.slot, calls, want)
+		}
+	}
+}
@@ -0,0 +1,13 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+//go:build !capacity_small && !capacity_large
+
+package tkeyoath
+
+// Capacity profile "default", as built with CAPACITY=default.
+const (
+	CapacityProfile        = "default"
+	TocDescriptorsMaxCount = 32
+	RecordNameMaxLen       = 64
+)
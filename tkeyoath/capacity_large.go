@@ -0,0 +1,13 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+//go:build capacity_large
+
+package tkeyoath
+
+// Capacity profile "large", as built with CAPACITY=large.
+const (
+	CapacityProfile        = "large"
+	TocDescriptorsMaxCount = 64
+	RecordNameMaxLen       = 64
+)
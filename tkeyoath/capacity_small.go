@@ -0,0 +1,13 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+//go:build capacity_small
+
+package tkeyoath
+
+// Capacity profile "small", as built with CAPACITY=small.
+const (
+	CapacityProfile        = "small"
+	TocDescriptorsMaxCount = 16
+	RecordNameMaxLen       = 32
+)
@@ -0,0 +1,307 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+)
+
+// ErrClosed is returned for requests made to, or still queued on, a
+// closed Client.
+var ErrClosed = errors.New("tkeyoath: client closed")
+
+// Code is the result of a calculation.
+type Code struct {
+	Code   uint32
+	Digits int
+	// Resealed is the record re-sealed with the bumped counter, for
+	// a HOTP record. The caller should persist it.
+	Resealed []byte
+	// Coalesced is set when the code came from a device call made
+	// for another caller.
+	Coalesced bool
+}
+
+// Metrics are counters of a Client since it was created. Wait is the
+// time from the first request for a device call to the start of that
+// call.
+type Metrics struct {
+	QueueDepth    int // device calls waiting for the worker
+	MaxQueueDepth int
+	Requests      uint64 // calls to Calculate and Do
+	Coalesced     uint64 // calculations that shared another's device call
+	Canceled      uint64 // requests whose context ended before their result
+	DeviceCalls   uint64
+	Errors        uint64 // failed device calls
+	WaitTotal     time.Duration
+	WaitMax       time.Duration
+	BusyTotal     time.Duration // time spent in device calls
+}
+
+// Client shares an App between goroutines. A single worker makes the
+// device calls in the order they were requested. Calculations of the
+// same sealed record for the same TOTP period (or, for a HOTP record,
+// of the same counter) that are queued or in progress are merged into
+// one device call, so a burst of callers asking for the same code
+// costs one exchange.
+type Client struct {
+	app App
+
+	mu       sync.Mutex
+	cond     *sync.Cond
+	queue    []*clientRequest
+	inflight map[calcKey]*clientRequest // calculations queued or running
+	closed   bool
+	done     chan struct{}
+	metrics  Metrics
+}
+
+// calcKey identifies the code a calculation yields: the sealed record,
+// and for TOTP the period it is asked for.
+type calcKey struct {
+	record string
+	period int64
+}
+
+type clientRequest struct {
+	// Either a calculation...
+	key    calcKey
+	record []byte
+	at     time.Time
+	// ...or a function run with the App
+	fn func(App) error
+
+	submitted time.Time
+	waiters   int
+	started   bool
+	done      chan struct{}
+
+	code     uint32
+	resealed []byte
+	err      error
+}
+
+// NewClient starts the worker for app, which the Client owns from now
+// on: close the Client rather than the App.
+func NewClient(app App) *Client {
+	c := &Client{
+		app:      app,
+		inflight: map[calcKey]*clientRequest{},
+		done:     make(chan struct{}),
+	}
+	c.cond = sync.NewCond(&c.mu)
+
+	go c.run()
+
+	return c
+}
+
+// Calculate returns the code of the sealed record valid at at. If
+// ctx ends first, Calculate returns its error; a device call already
+// started still completes, for the other callers sharing it.
+func (c *Client) Calculate(ctx context.Context, record []byte, at time.Time) (Code, error) {
+	protected, ok := secureRecordProtected(record)
+	if !ok || len(record) != SecureOathRecordSize {
+		return Code{}, fmt.Errorf("sealed record is %d bytes, want %d", len(record), SecureOathRecordSize)
+	}
+
+	key := calcKey{record: string(record)}
+	if protected.properties&oathPropTypeHOTP == 0 {
+		if protected.counterOrTimestep == 0 {
+			return Code{}, fmt.Errorf("TOTP record with a zero timestep")
+		}
+		key.period = at.Unix() / int64(protected.counterOrTimestep)
+	}
+
+	c.mu.Lock()
+	r, coalesced := c.inflight[key]
+	if coalesced {
+		r.waiters++
+		c.metrics.Requests++
+		c.metrics.Coalesced++
+		c.mu.Unlock()
+	} else {
+		r = &clientRequest{key: key, record: append([]byte(nil), record...), at: at}
+		if err := c.submitLocked(r); err != nil {
+			c.mu.Unlock()
+			return Code{}, err
+		}
+		c.inflight[key] = r
+		c.mu.Unlock()
+	}
+
+	if err := c.wait(ctx, r); err != nil {
+		return Code{}, err
+	}
+
+	code := Code{
+		Code:      r.code,
+		Digits:    int(protected.digits),
+		Coalesced: coalesced,
+	}
+	if r.resealed != nil {
+		code.Resealed = append([]byte(nil), r.resealed...)
+	}
+
+	return code, nil
+}
+
+// Do runs fn with the App on the worker, between other device calls,
+// for operations other than calculations, e.g. loading a ToC. If ctx
+// ends before fn starts, fn is not run; if it ends while fn runs, Do
+// returns without waiting for it.
+func (c *Client) Do(ctx context.Context, fn func(App) error) error {
+	r := &clientRequest{fn: fn}
+
+	c.mu.Lock()
+	err := c.submitLocked(r)
+	c.mu.Unlock()
+	if err != nil {
+		return err
+	}
+
+	return c.wait(ctx, r)
+}
+
+// Metrics returns a snapshot of the client's metrics.
+func (c *Client) Metrics() Metrics {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	return c.metrics
+}
+
+// Close fails the queued requests with ErrClosed, waits for the device
+// call in progress, if any, and closes the App.
+func (c *Client) Close() error {
+	c.mu.Lock()
+	if c.closed {
+		c.mu.Unlock()
+		return nil
+	}
+	c.closed = true
+	for _, r := range c.queue {
+		r.err = ErrClosed
+		c.finishLocked(r)
+	}
+	c.queue = nil
+	c.metrics.QueueDepth = 0
+	c.cond.Broadcast()
+	c.mu.Unlock()
+
+	<-c.done
+
+	return c.app.Close()
+}
+
+func (c *Client) submitLocked(r *clientRequest) error {
+	if c.closed {
+		return ErrClosed
+	}
+
+	r.submitted = time.Now()
+	r.waiters = 1
+	r.done = make(chan struct{})
+	c.queue = append(c.queue, r)
+
+	c.metrics.Requests++
+	c.metrics.QueueDepth = len(c.queue)
+	if c.metrics.QueueDepth > c.metrics.MaxQueueDepth {
+		c.metrics.MaxQueueDepth = c.metrics.QueueDepth
+	}
+	c.cond.Signal()
+
+	return nil
+}
+
+// wait waits for r to complete or ctx to end. The last waiter to give
+// up on a request that has not started yet removes it from the queue.
+func (c *Client) wait(ctx context.Context, r *clientRequest) error {
+	select {
+	case <-r.done:
+		return r.err
+	case <-ctx.Done():
+	}
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	select {
+	case <-r.done:
+		return r.err
+	default:
+	}
+
+	c.metrics.Canceled++
+	r.waiters--
+	if r.waiters == 0 && !r.started {
+		for i, q := range c.queue {
+			if q == r {
+				c.queue = append(c.queue[:i], c.queue[i+1:]...)
+				break
+			}
+		}
+		c.metrics.QueueDepth = len(c.queue)
+		r.err = ctx.Err()
+		c.finishLocked(r)
+	}
+
+	return ctx.Err()
+}
+
+func (c *Client) finishLocked(r *clientRequest) {
+	if r.fn == nil && c.inflight[r.key] == r {
+		delete(c.inflight, r.key)
+	}
+	close(r.done)
+}
+
+func (c *Client) run() {
+	defer close(c.done)
+
+	for {
+		c.mu.Lock()
+		for len(c.queue) == 0 && !c.closed {
+			c.cond.Wait()
+		}
+		if c.closed {
+			c.mu.Unlock()
+			return
+		}
+
+		r := c.queue[0]
+		c.queue = c.queue[1:]
+		r.started = true
+
+		start := time.Now()
+		wait := start.Sub(r.submitted)
+		c.metrics.QueueDepth = len(c.queue)
+		c.metrics.WaitTotal += wait
+		if wait > c.metrics.WaitMax {
+			c.metrics.WaitMax = wait
+		}
+		c.mu.Unlock()
+
+		var err error
+		if r.fn != nil {
+			err = r.fn(c.app)
+		} else {
+			r.code, r.resealed, err = c.app.Calculate(MakeCalculateRequestAt(r.record, r.at))
+		}
+
+		c.mu.Lock()
+		r.err = err
+		c.metrics.DeviceCalls++
+		c.metrics.BusyTotal += time.Since(start)
+		if err != nil {
+			c.metrics.Errors++
+		}
+		c.finishLocked(r)
+		c.mu.Unlock()
+	}
+}
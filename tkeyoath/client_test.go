@@ -0,0 +1,372 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"context"
+	"errors"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/tillitis/tkeyclient"
+	"go.bug.st/serial"
+)
+
+// fakePort stands in for a TKey running the app: every frame written
+// to it is answered with a reply of the same ID, carrying for
+// CALCULATE a code counted up from 1. Bytes that do not start a frame,
+// e.g. resync filler, are dropped. Replies wait for a value on hold,
+// if set, so that tests can keep the worker in a device call.
+type fakePort struct {
+	serial.Port // the methods Conn does not use panic
+
+	hold chan struct{}
+
+	mu      sync.Mutex
+	cond    *sync.Cond
+	rx      []byte
+	calls   map[byte]int // frames written, by command code
+	codes   uint32
+	timeout time.Duration
+	closed  bool
+}
+
+func newFakePort() *fakePort {
+	p := &fakePort{calls: map[byte]int{}}
+	p.cond = sync.NewCond(&p.mu)
+
+	return p
+}
+
+func (p *fakePort) Write(d []byte) (int, error) {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	hdr, err := parseFrameHeader(d[0])
+	if err != nil {
+		return len(d), nil
+	}
+	p.calls[d[1]]++
+
+	reply := make([]byte, 1+tkeyclient.CmdLen32.Bytelen())
+	reply[0] = hdr.ID<<5 | byte(tkeyclient.DestApp)<<3 | byte(tkeyclient.CmdLen32)
+	reply[1] = d[1] + 1
+	reply[2] = tkeyclient.StatusOK
+	if d[1] == cmdCalculate.Code() {
+		p.codes++
+		reply[3], reply[4], reply[5], reply[6] = byte(p.codes), byte(p.codes>>8), byte(p.codes>>16), byte(p.codes>>24)
+	}
+
+	go func() {
+		if p.hold != nil {
+			<-p.hold
+		}
+		p.mu.Lock()
+		p.rx = append(p.rx, reply...)
+		p.cond.Broadcast()
+		p.mu.Unlock()
+	}()
+
+	return len(d), nil
+}
+
+// Read blocks until a reply is available, or returns 0 bytes, as a
+// read timeout does, once the timeout set, if any, expires or the port
+// is closed.
+func (p *fakePort) Read(d []byte) (int, error) {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	expired := false
+	if p.timeout > 0 {
+		timer := time.AfterFunc(p.timeout, func() {
+			p.mu.Lock()
+			expired = true
+			p.cond.Broadcast()
+			p.mu.Unlock()
+		})
+		defer timer.Stop()
+	}
+	for len(p.rx) == 0 && !p.closed && !expired {
+		p.cond.Wait()
+	}
+	n := copy(d, p.rx)
+	p.rx = p.rx[n:]
+
+	return n, nil
+}
+
+func (p *fakePort) SetReadTimeout(timeout time.Duration) error {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	p.timeout = timeout
+
+	return nil
+}
+
+func (p *fakePort) ResetInputBuffer() error {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	p.rx = nil
+
+	return nil
+}
+
+func (p *fakePort) Close() error {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	p.closed = true
+	p.cond.Broadcast()
+
+	return nil
+}
+
+func (p *fakePort) deviceCalls(code byte) int {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	return p.calls[code]
+}
+
+func newTestClient(t *testing.T, port *fakePort) *Client {
+	t.Helper()
+
+	c := NewClient(New(&Conn{port: port}))
+	t.Cleanup(func() { c.Close() })
+
+	return c
+}
+
+// testTOTPRecord is a sealed TOTP record with a 30 s timestep; seed
+// tells records apart.
+func testTOTPRecord(seed byte) []byte {
+	record := make([]byte, SecureOathRecordSize)
+	record[0] = seed
+	oathRecordProtected{counterOrTimestep: 30, properties: oathPropTypeTOTP, digits: 6}.
+		encode(record[oathRecordSecretSize:])
+
+	return record
+}
+
+// waitFor polls cond until it holds, failing the test after a while.
+func waitFor(t *testing.T, what string, cond func() bool) {
+	t.Helper()
+
+	deadline := time.Now().Add(5 * time.Second)
+	for !cond() {
+		if time.Now().After(deadline) {
+			t.Fatalf("timed out waiting for %s", what)
+		}
+		time.Sleep(time.Millisecond)
+	}
+}
+
+// blockWorker keeps the worker of c in a call to Do until the
+// returned function is called.
+func blockWorker(t *testing.T, c *Client) func() {
+	t.Helper()
+
+	release := make(chan struct{})
+	running := make(chan struct{})
+	go func() {
+		c.Do(context.Background(), func(App) error {
+			close(running)
+			<-release
+			return nil
+		})
+	}()
+	<-running
+
+	var once sync.Once
+	return func() { once.Do(func() { close(release) }) }
+}
+
+func TestClientCoalescesCalculations(t *testing.T) {
+	const callers = 32
+
+	port := newFakePort()
+	port.hold = make(chan struct{})
+	c := newTestClient(t, port)
+
+	record := testTOTPRecord(1)
+	at := time.Unix(1_700_000_010, 0)
+
+	var wg sync.WaitGroup
+	codes := make([]Code, callers)
+	errs := make([]error, callers)
+	for i := 0; i < callers; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			// Same period, at different times within it
+			codes[i], errs[i] = c.Calculate(context.Background(), record, at.Add(time.Duration(i%10)*time.Second))
+		}(i)
+	}
+	waitFor(t, "the callers to queue", func() bool { return c.Metrics().Requests == callers })
+	close(port.hold)
+	wg.Wait()
+
+	coalesced := 0
+	for i := range codes {
+		if errs[i] != nil {
+			t.Fatalf("caller %d: %v", i, errs[i])
+		}
+		if codes[i].Code != 1 || codes[i].Digits != 6 {
+			t.Errorf("caller %d: %+v, want code 1 of 6 digits", i, codes[i])
+		}
+		if codes[i].Coalesced {
+			coalesced++
+		}
+	}
+	if n := port.deviceCalls(cmdCalculate.Code()); n != 1 {
+		t.Errorf("%d device calls for %d callers, want 1", n, callers)
+	}
+	m := c.Metrics()
+	if m.DeviceCalls != 1 || m.Coalesced != callers-1 || coalesced != callers-1 {
+		t.Errorf("metrics %+v, %d coalesced codes, want 1 device call and %d coalesced", m, coalesced, callers-1)
+	}
+
+	// The next period is another code
+	code, err := c.Calculate(context.Background(), record, at.Add(30*time.Second))
+	if err != nil || code.Code != 2 || code.Coalesced {
+		t.Errorf("next period: %+v, %v", code, err)
+	}
+	if n := port.deviceCalls(cmdCalculate.Code()); n != 2 {
+		t.Errorf("%d device calls after the next period, want 2", n)
+	}
+}
+
+func TestClientCanceledWhileQueued(t *testing.T) {
+	port := newFakePort()
+	c := newTestClient(t, port)
+	release := blockWorker(t, c)
+	defer release()
+
+	ctx, cancel := context.WithCancel(context.Background())
+	result := make(chan error, 1)
+	go func() {
+		_, err := c.Calculate(ctx, testTOTPRecord(1), time.Unix(1_700_000_000, 0))
+		result <- err
+	}()
+	waitFor(t, "the request to queue", func() bool { return c.Metrics().QueueDepth == 1 })
+
+	cancel()
+	select {
+	case err := <-result:
+		if !errors.Is(err, context.Canceled) {
+			t.Fatalf("Calculate: %v, want %v", err, context.Canceled)
+		}
+	case <-time.After(5 * time.Second):
+		t.Fatal("Calculate did not return once canceled")
+	}
+	if m := c.Metrics(); m.QueueDepth != 0 || m.Canceled != 1 {
+		t.Errorf("metrics %+v, want an empty queue and 1 canceled", m)
+	}
+
+	release()
+	if _, err := c.Calculate(context.Background(), testTOTPRecord(2), time.Unix(1_700_000_000, 0)); err != nil {
+		t.Fatalf("Calculate after the cancellation: %v", err)
+	}
+	// The canceled calculation never reached the device
+	if n := port.deviceCalls(cmdCalculate.Code()); n != 1 {
+		t.Errorf("%d device calls, want 1", n)
+	}
+}
+
+func TestClientCanceledDuringCall(t *testing.T) {
+	port := newFakePort()
+	port.hold = make(chan struct{})
+	c := newTestClient(t, port)
+	record := testTOTPRecord(1)
+	at := time.Unix(1_700_000_000, 0)
+
+	ctx, cancel := context.WithCancel(context.Background())
+	result := make(chan error, 1)
+	go func() {
+		_, err := c.Calculate(ctx, record, at)
+		result <- err
+	}()
+	waitFor(t, "the device call", func() bool { return port.deviceCalls(cmdCalculate.Code()) == 1 })
+
+	// Another caller shares the call in progress, and outlives the
+	// first one giving up on it
+	shared := make(chan Code, 1)
+	go func() {
+		code, err := c.Calculate(context.Background(), record, at)
+		if err != nil {
+			t.Errorf("shared Calculate: %v", err)
+		}
+		shared <- code
+	}()
+	waitFor(t, "the second caller", func() bool { return c.Metrics().Coalesced == 1 })
+
+	cancel()
+	select {
+	case err := <-result:
+		if !errors.Is(err, context.Canceled) {
+			t.Fatalf("Calculate: %v, want %v", err, context.Canceled)
+		}
+	case <-time.After(5 * time.Second):
+		t.Fatal("Calculate did not return while the device call was in progress")
+	}
+
+	close(port.hold)
+	if code := <-shared; code.Code != 1 || !code.Coalesced {
+		t.Errorf("shared code %+v, want code 1, coalesced", code)
+	}
+
+	// The worker went on
+	if err := c.Do(context.Background(), func(App) error { return nil }); err != nil {
+		t.Fatalf("Do: %v", err)
+	}
+	if m := c.Metrics(); m.DeviceCalls != 2 || m.Canceled != 1 {
+		t.Errorf("metrics %+v, want 2 device calls and 1 canceled", m)
+	}
+}
+
+func TestClientQueueMetrics(t *testing.T) {
+	const queued = 4
+	const blocked = 20 * time.Millisecond
+
+	port := newFakePort()
+	c := newTestClient(t, port)
+	release := blockWorker(t, c)
+	defer release()
+
+	var wg sync.WaitGroup
+	for i := 0; i < queued; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			if _, err := c.Calculate(context.Background(), testTOTPRecord(byte(i)), time.Unix(1_700_000_000, 0)); err != nil {
+				t.Errorf("Calculate %d: %v", i, err)
+			}
+		}(i)
+	}
+	waitFor(t, "the requests to queue", func() bool { return c.Metrics().QueueDepth == queued })
+
+	time.Sleep(blocked)
+	release()
+	wg.Wait()
+
+	m := c.Metrics()
+	if m.QueueDepth != 0 || m.MaxQueueDepth != queued {
+		t.Errorf("queue depth %d, max %d, want 0 and %d", m.QueueDepth, m.MaxQueueDepth, queued)
+	}
+	if m.Requests != queued+1 || m.DeviceCalls != queued+1 || m.Coalesced != 0 || m.Errors != 0 {
+		t.Errorf("metrics %+v, want %d requests and device calls", m, queued+1)
+	}
+	// Each queued request waited at least as long as the worker was
+	// held
+	if m.WaitMax < blocked || m.WaitTotal < queued*blocked {
+		t.Errorf("wait max %v, total %v, want at least %v and %v", m.WaitMax, m.WaitTotal, blocked, queued*blocked)
+	}
+	if m.BusyTotal < blocked {
+		t.Errorf("busy %v, want at least %v", m.BusyTotal, blocked)
+	}
+}
@@ -0,0 +1,188 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"encoding/binary"
+	"fmt"
+)
+
+// Encoding of the packed structs of app/definitions.h. The device is
+// little-endian RISC-V, and every struct is packed, so each field sits
+// at the offset given by the sum of the sizes before it.
+
+// Crypto sizes, as in app/definitions.h. The capacities are set by
+// the capacity profile, see capacity_*.go.
+const (
+	recordKeyMaxLen   = 66 // 64 + 2 for algo & digits
+	xchacha20NonceLen = 24
+	xchacha20MacLen   = 16
+	MigrateKeyLen     = 32
+	MigrateDigestLen  = 32 // BLAKE2s-256 of an app binary
+)
+
+// Query flags of APP_CMD_LOOKUP, as in app/index.h.
+const indexQueryPrefix = 1 << 0
+
+// Modes of APP_CMD_MIGRATE_START, as in app/migrate.h.
+const (
+	MigrateModeExport = 0x01
+	MigrateModeImport = 0x02
+)
+
+// Bits of toc_header_protected_t.settings and
+// oath_record_protected_t.properties.
+const (
+	tocSettingTouchYes = 1 << 7
+
+	oathPropTypeTOTP = 0 << 7
+	oathPropTypeHOTP = 1 << 7
+	oathPropTouchNo  = 0 << 4
+	oathPropTouchYes = 1 << 4
+)
+
+// Packed struct sizes.
+const (
+	oathRecordSecretSize    = 1 + recordKeyMaxLen                                                     // oath_record_secret_t
+	oathRecordProtectedSize = 8 + 1 + 1                                                               // oath_record_protected_t
+	oathRecordSize          = oathRecordSecretSize + oathRecordProtectedSize                          // oath_record_t
+	SecureOathRecordSize    = oathRecordSize + xchacha20NonceLen + xchacha20MacLen                    // secure_oath_record_t
+	oathRecordPutSize       = oathRecordSize + 1 + RecordNameMaxLen                                   // oath_record_put_t
+	oathCalculateSize       = SecureOathRecordSize + 4                                                // oath_calculate_t
+	TocRecordDescriptorSize = 1 + RecordNameMaxLen                                                    // toc_record_descriptor_t
+	tocHeaderProtectedSize  = 1                                                                       // toc_header_protected_t
+	decryptedTocHeaderSize  = 1 + xchacha20NonceLen + xchacha20MacLen + tocHeaderProtectedSize        // decrypted_toc_header_t
+	decryptedTocSize        = decryptedTocHeaderSize + TocDescriptorsMaxCount*TocRecordDescriptorSize // decrypted_toc_t
+)
+
+// oathRecordProtected is the metadata authenticated, but not
+// encrypted, along with a record.
+type oathRecordProtected struct {
+	counterOrTimestep uint64
+	properties        uint8
+	digits            uint8
+}
+
+func (p oathRecordProtected) encode(dst []byte) {
+	binary.LittleEndian.PutUint64(dst[0:], p.counterOrTimestep)
+	dst[8] = p.properties
+	dst[9] = p.digits
+}
+
+func decodeOathRecordProtected(src []byte) oathRecordProtected {
+	return oathRecordProtected{
+		counterOrTimestep: binary.LittleEndian.Uint64(src[0:]),
+		properties:        src[8],
+		digits:            src[9],
+	}
+}
+
+// encodeOathRecordSecret writes an oath_record_secret_t, the
+// plaintext of a record's encrypted_blob.
+func encodeOathRecordSecret(dst []byte, key []byte) error {
+	if len(key) > recordKeyMaxLen {
+		return fmt.Errorf("key too long: %d > %d bytes", len(key), recordKeyMaxLen)
+	}
+	dst[0] = uint8(len(key))
+	copy(dst[1:oathRecordSecretSize], key)
+
+	return nil
+}
+
+// encodeOathRecordPut writes an oath_record_put_t into dst, which
+// must be oathRecordPutSize zeroed bytes.
+func encodeOathRecordPut(dst []byte, key []byte, protected oathRecordProtected, name []byte) error {
+	if len(name) > RecordNameMaxLen {
+		return fmt.Errorf("name too long: %d > %d bytes", len(name), RecordNameMaxLen)
+	}
+	if err := encodeOathRecordSecret(dst, key); err != nil {
+		return err
+	}
+	protected.encode(dst[oathRecordSecretSize:])
+	dst[oathRecordSize] = uint8(len(name))
+	copy(dst[oathRecordSize+1:oathRecordPutSize], name)
+
+	return nil
+}
+
+// encodeOathCalculate writes an oath_calculate_t into dst, which must
+// be oathCalculateSize bytes.
+func encodeOathCalculate(dst []byte, secureRecord []byte, time uint32) error {
+	if len(secureRecord) != SecureOathRecordSize {
+		return fmt.Errorf("sealed record is %d bytes, want %d", len(secureRecord), SecureOathRecordSize)
+	}
+	copy(dst, secureRecord)
+	binary.LittleEndian.PutUint32(dst[SecureOathRecordSize:], time)
+
+	return nil
+}
+
+// secureRecordProtected returns the metadata of a secure_oath_record_t,
+// or of an oath_calculate_t which starts with one.
+func secureRecordProtected(record []byte) (oathRecordProtected, bool) {
+	if len(record) < oathRecordSize {
+		return oathRecordProtected{}, false
+	}
+
+	return decodeOathRecordProtected(record[oathRecordSecretSize:]), true
+}
+
+// decryptedTocHeader is the header of a ToC as the device exports it.
+// Only the descriptors are encrypted.
+type decryptedTocHeader struct {
+	descriptorCount uint8
+	nonce           [xchacha20NonceLen]byte
+	mac             [xchacha20MacLen]byte
+	settings        uint8
+}
+
+func decodeDecryptedTocHeader(src []byte) (decryptedTocHeader, error) {
+	var hdr decryptedTocHeader
+	if len(src) < decryptedTocHeaderSize {
+		return hdr, fmt.Errorf("ToC header is %d bytes, want %d", len(src), decryptedTocHeaderSize)
+	}
+	hdr.descriptorCount = src[0]
+	copy(hdr.nonce[:], src[1:])
+	copy(hdr.mac[:], src[1+xchacha20NonceLen:])
+	hdr.settings = src[1+xchacha20NonceLen+xchacha20MacLen]
+
+	return hdr, nil
+}
+
+// ToCDescriptorCount is the number of records listed in a sealed ToC,
+// read from its unencrypted header.
+func ToCDescriptorCount(toc []byte) (int, error) {
+	hdr, err := decodeDecryptedTocHeader(toc)
+	if err != nil {
+		return 0, err
+	}
+
+	return int(hdr.descriptorCount), nil
+}
+
+// sealedTocSize is the size of an exported ToC holding count
+// descriptors.
+func sealedTocSize(count int) int {
+	return decryptedTocHeaderSize + count*TocRecordDescriptorSize
+}
+
+// decodeTocRecordDescriptors returns the names in a list of
+// toc_record_descriptor_t, as returned by GetList.
+func decodeTocRecordDescriptors(src []byte) ([]string, error) {
+	if len(src)%TocRecordDescriptorSize != 0 {
+		return nil, fmt.Errorf("descriptor list of %d bytes is not a multiple of %d",
+			len(src), TocRecordDescriptorSize)
+	}
+
+	names := make([]string, 0, len(src)/TocRecordDescriptorSize)
+	for off := 0; off < len(src); off += TocRecordDescriptorSize {
+		nameLen := int(src[off])
+		if nameLen > RecordNameMaxLen {
+			return nil, fmt.Errorf("descriptor name length %d > %d", nameLen, RecordNameMaxLen)
+		}
+		names = append(names, string(src[off+1:off+1+nameLen]))
+	}
+
+	return names, nil
+}
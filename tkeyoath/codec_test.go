@@ -0,0 +1,290 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/hex"
+	"encoding/json"
+	"os"
+	"regexp"
+	"strconv"
+	"testing"
+)
+
+// The golden files hold the packed C layout of every struct of
+// app/definitions.h, as written by testdata/golden.c for each capacity
+// profile (make golden). The tests run for the profile the package is
+// built with: go test -tags capacity_small, capacity_large, or none.
+
+// Inputs of testdata/golden.c.
+var (
+	goldenKey = []byte{0x00, 0x08, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x21,
+		0xde, 0xad, 0xbe, 0xef, 0x01, 0x02, 0x03, 0x04,
+		0x05, 0x06, 0x07, 0x08, 0x09, 0x0a}
+	goldenName      = []byte("alice@example.com")
+	goldenProtected = oathRecordProtected{
+		counterOrTimestep: 0x0102030405060708,
+		properties:        oathPropTypeHOTP | oathPropTouchYes,
+		digits:            8,
+	}
+	goldenTime = uint32(0x5f5e1000)
+)
+
+type golden struct {
+	TocDescriptorsMaxCount int               `json:"toc_descriptors_maxcount"`
+	RecordNameMaxLen       int               `json:"record_name_maxlen"`
+	Sizes                  map[string]int    `json:"sizes"`
+	Vectors                map[string]string `json:"vectors"`
+}
+
+func loadGolden(t testing.TB) golden {
+	t.Helper()
+
+	data, err := os.ReadFile("testdata/golden_" + CapacityProfile + ".json")
+	if err != nil {
+		t.Fatal(err)
+	}
+	var g golden
+	if err = json.Unmarshal(data, &g); err != nil {
+		t.Fatal(err)
+	}
+
+	return g
+}
+
+func (g golden) vector(t *testing.T, name string) []byte {
+	t.Helper()
+
+	v, ok := g.Vectors[name]
+	if !ok {
+		t.Fatalf("no golden vector for %s", name)
+	}
+	b, err := hex.DecodeString(v)
+	if err != nil {
+		t.Fatalf("%s: %v", name, err)
+	}
+
+	return b
+}
+
+// definitionsMacros returns the integer macros of app/definitions.h
+// defined for the capacity profile of the build.
+func definitionsMacros(t *testing.T) map[string]int {
+	t.Helper()
+
+	f, err := os.Open("../app/definitions.h")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer f.Close()
+
+	branch := map[string]string{
+		"small": "CAPACITY_SMALL",
+		"large": "CAPACITY_LARGE",
+	}[CapacityProfile]
+
+	conditional := regexp.MustCompile(`^#(if|elif) defined\((\w+)\)`)
+	define := regexp.MustCompile(`^#define\s+(\w+)\s+(\d+)\b`)
+	macros := map[string]int{}
+	// In the capacity #if chain, taken tells whether the current
+	// branch is the profile's, and done whether one was
+	inChain, taken, done := false, true, false
+
+	sc := bufio.NewScanner(f)
+	for sc.Scan() {
+		line := sc.Text()
+		switch m := conditional.FindStringSubmatch(line); {
+		case m != nil && (m[1] == "elif" || m[2] == "CAPACITY_SMALL"):
+			inChain = true
+			taken = !done && m[2] == branch
+			done = done || taken
+			continue
+		case inChain && line == "#else":
+			taken = !done
+			continue
+		case inChain && line == "#endif":
+			inChain, taken = false, true
+			continue
+		}
+		if m := define.FindStringSubmatch(line); m != nil && taken {
+			macros[m[1]], _ = strconv.Atoi(m[2])
+		}
+	}
+	if err = sc.Err(); err != nil {
+		t.Fatal(err)
+	}
+
+	return macros
+}
+
+func TestCodecCapacity(t *testing.T) {
+	g := loadGolden(t)
+	macros := definitionsMacros(t)
+
+	for _, c := range []struct {
+		name       string
+		got, macro int
+	}{
+		{"TOC_DESCRIPTORS_MAXCOUNT", TocDescriptorsMaxCount, macros["TOC_DESCRIPTORS_MAXCOUNT"]},
+		{"RECORD_NAME_MAXLEN", RecordNameMaxLen, macros["RECORD_NAME_MAXLEN"]},
+		{"RECORD_KEY_MAXLEN", recordKeyMaxLen, macros["RECORD_KEY_MAXLEN"]},
+		{"XCHACHA20_NONCE_LEN", xchacha20NonceLen, macros["XCHACHA20_NONCE_LEN"]},
+		{"XCHACHA20_MAC_LEN", xchacha20MacLen, macros["XCHACHA20_MAC_LEN"]},
+	} {
+		if c.got != c.macro {
+			t.Errorf("%s is %d in profile %s, definitions.h has %d", c.name, c.got, CapacityProfile, c.macro)
+		}
+	}
+
+	if g.TocDescriptorsMaxCount != TocDescriptorsMaxCount || g.RecordNameMaxLen != RecordNameMaxLen {
+		t.Errorf("golden_%s.json was generated for %d descriptors of %d-byte names, the package has %d of %d",
+			CapacityProfile, g.TocDescriptorsMaxCount, g.RecordNameMaxLen, TocDescriptorsMaxCount, RecordNameMaxLen)
+	}
+}
+
+func TestCodecSizes(t *testing.T) {
+	g := loadGolden(t)
+
+	sizes := map[string]int{
+		"oath_record_secret":    oathRecordSecretSize,
+		"oath_record_protected": oathRecordProtectedSize,
+		"oath_record":           oathRecordSize,
+		"secure_oath_record":    SecureOathRecordSize,
+		"oath_record_put":       oathRecordPutSize,
+		"oath_calculate":        oathCalculateSize,
+		"toc_record_descriptor": TocRecordDescriptorSize,
+		"toc_header_protected":  tocHeaderProtectedSize,
+		"decrypted_toc_header":  decryptedTocHeaderSize,
+		"decrypted_toc":         decryptedTocSize,
+	}
+	if len(g.Sizes) != len(sizes) {
+		t.Errorf("golden_%s.json has %d structs, the codec %d", CapacityProfile, len(g.Sizes), len(sizes))
+	}
+	for name, size := range sizes {
+		if want, ok := g.Sizes[name]; !ok || size != want {
+			t.Errorf("sizeof(%s_t) = %d, codec has %d", name, want, size)
+		}
+	}
+}
+
+func TestCodecEncode(t *testing.T) {
+	g := loadGolden(t)
+
+	secret := make([]byte, oathRecordSecretSize)
+	if err := encodeOathRecordSecret(secret, goldenKey); err != nil {
+		t.Fatal(err)
+	}
+
+	protected := make([]byte, oathRecordProtectedSize)
+	goldenProtected.encode(protected)
+
+	put := make([]byte, oathRecordPutSize)
+	if err := encodeOathRecordPut(put, goldenKey, goldenProtected, goldenName); err != nil {
+		t.Fatal(err)
+	}
+
+	calculate := make([]byte, oathCalculateSize)
+	if err := encodeOathCalculate(calculate, g.vector(t, "secure_oath_record"), goldenTime); err != nil {
+		t.Fatal(err)
+	}
+
+	for _, c := range []struct {
+		name string
+		got  []byte
+	}{
+		{"oath_record_secret", secret},
+		{"oath_record_protected", protected},
+		{"oath_record_put", put},
+		{"oath_calculate", calculate},
+	} {
+		if want := g.vector(t, c.name); !bytes.Equal(c.got, want) {
+			t.Errorf("%s:\n got %x\nwant %x", c.name, c.got, want)
+		}
+	}
+}
+
+func TestCodecDecode(t *testing.T) {
+	g := loadGolden(t)
+
+	if p, ok := secureRecordProtected(g.vector(t, "secure_oath_record")); !ok || p != goldenProtected {
+		t.Errorf("secure_oath_record protected = %+v, want %+v", p, goldenProtected)
+	}
+	if p, ok := secureRecordProtected(g.vector(t, "oath_calculate")); !ok || p != goldenProtected {
+		t.Errorf("oath_calculate protected = %+v, want %+v", p, goldenProtected)
+	}
+
+	raw := g.vector(t, "decrypted_toc_header")
+	hdr, err := decodeDecryptedTocHeader(raw)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if hdr.descriptorCount != 3 || hdr.settings != tocSettingTouchYes ||
+		hdr.nonce[0] != 0x21 || hdr.mac[0] != 0x31 {
+		t.Errorf("decrypted_toc_header = %+v", hdr)
+	}
+	if hdr.settings != g.vector(t, "toc_header_protected")[0] {
+		t.Errorf("settings 0x%02x, toc_header_protected has 0x%02x", hdr.settings, g.vector(t, "toc_header_protected")[0])
+	}
+	if count, err := ToCDescriptorCount(raw); err != nil || count != 3 {
+		t.Errorf("ToCDescriptorCount = %d, %v", count, err)
+	}
+
+	descriptor := g.vector(t, "toc_record_descriptor")
+	names, err := decodeTocRecordDescriptors(append(descriptor, descriptor...))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(names) != 2 || names[0] != string(goldenName) || names[1] != string(goldenName) {
+		t.Errorf("toc_record_descriptor names = %q", names)
+	}
+}
+
+// benchRecords is the number of records encoded per iteration, a
+// bundle larger than the ToC of any profile holds, as a migration
+// or a bulk import encodes them.
+const benchRecords = 1024
+
+func BenchmarkEncodePutRecord(b *testing.B) {
+	names := make([][]byte, benchRecords)
+	for i := range names {
+		names[i] = []byte("account" + strconv.Itoa(i) + "@example.com")
+	}
+	dst := make([]byte, oathRecordPutSize)
+	zero := make([]byte, oathRecordPutSize)
+
+	b.SetBytes(benchRecords * oathRecordPutSize)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for i := range names {
+			copy(dst, zero)
+			protected := goldenProtected
+			protected.counterOrTimestep += uint64(i)
+			if err := encodeOathRecordPut(dst, goldenKey, protected, names[i]); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+}
+
+func BenchmarkEncodeCalculate(b *testing.B) {
+	records := make([][]byte, benchRecords)
+	for i := range records {
+		records[i] = bytes.Repeat([]byte{byte(i)}, SecureOathRecordSize)
+	}
+	dst := make([]byte, oathCalculateSize)
+
+	b.SetBytes(benchRecords * oathCalculateSize)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for i := range records {
+			if err := encodeOathCalculate(dst, records[i], goldenTime+uint32(i)); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+}
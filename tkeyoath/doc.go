@@ -0,0 +1,38 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Package tkeyoath talks to the oath device app running on a TKey.
+//
+// App speaks the app protocol over a Conn, one command at a time, and
+// is what the runoath client uses. It must not be used from several
+// goroutines at once. Services sharing a TKey between goroutines
+// should use a Client, which runs every device call on a single
+// worker, merges concurrent calculations of the same code and reports
+// queueing metrics:
+//
+//	conn, err := tkeyoath.OpenConn(port, tkeyclient.SerialSpeed)
+//	...
+//	client := tkeyoath.NewClient(tkeyoath.New(conn))
+//	defer client.Close()
+//	err = client.Do(ctx, func(app tkeyoath.App) error {
+//		return app.LoadToC(toc)
+//	})
+//	...
+//	code, err := client.Calculate(ctx, record, time.Now())
+//
+// The device app must already be loaded, e.g. with tkeyclient's
+// LoadApp, and the connection tkeyclient used closed.
+package tkeyoath
+
+import (
+	"io"
+	"log"
+)
+
+// le logs protocol errors. It is silent unless SetLogOutput is called.
+var le = log.New(io.Discard, "", 0)
+
+// SetLogOutput sets where the package logs protocol errors.
+func SetLogOutput(w io.Writer) {
+	le.SetOutput(w)
+}
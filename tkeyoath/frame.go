@@ -0,0 +1,252 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"errors"
+	"fmt"
+	"io"
+	"time"
+
+	"github.com/tillitis/tkeyclient"
+	"go.bug.st/serial"
+)
+
+// Conn is the serial connection to the device app once it runs.
+// It frames commands like tkeyclient, but the app replies with the
+// smallest frame that fits each response, so a reply may be shorter
+// than the length of its response code. tkeyclient's ReadFrame only
+// accepts that exact length, so Conn reads frames itself.
+type Conn struct {
+	port  serial.Port
+	speed int // bps, 0 for tkeyclient.SerialSpeed
+
+	txBytes uint64 // bytes written, frame headers included
+	rxBytes uint64 // bytes read, frame headers included
+
+	tracer    *Tracer
+	lastWrite time.Duration // when the last write ended, on the tracer's clock
+	recorder  *Recorder
+}
+
+func OpenConn(devPath string, speed int) (*Conn, error) {
+	port, err := serial.Open(devPath, &serial.Mode{BaudRate: speed})
+	if err != nil {
+		return nil, fmt.Errorf("serial.Open: %w", err)
+	}
+
+	return &Conn{port: port, speed: speed}, nil
+}
+
+func (c *Conn) Close() error {
+	if err := c.port.Close(); err != nil {
+		return fmt.Errorf("Close: %w", err)
+	}
+
+	return nil
+}
+
+// byteTime is how long a byte takes on the line: a start bit, 8 data
+// bits and a stop bit.
+func (c *Conn) byteTime() time.Duration {
+	speed := c.speed
+	if speed <= 0 {
+		speed = tkeyclient.SerialSpeed
+	}
+
+	return 10 * time.Second / time.Duration(speed)
+}
+
+// SetTracer records the timing of the frames exchanged from now on
+// with t. A nil t stops recording.
+func (c *Conn) SetTracer(t *Tracer) {
+	c.tracer = t
+}
+
+// SetRecorder logs the frames exchanged from now on with r. A nil r
+// stops logging.
+func (c *Conn) SetRecorder(r *Recorder) {
+	c.recorder = r
+}
+
+// span starts a span of the tracer, if any, and returns the function
+// ending it.
+func (c *Conn) span(name string) func() {
+	return c.tracer.Span(name)
+}
+
+// SetReadTimeout sets the timeout of reads, in seconds. 0 means no
+// timeout.
+func (c *Conn) SetReadTimeout(seconds int) error {
+	timeout := serial.NoTimeout
+	if seconds > 0 {
+		timeout = time.Duration(seconds) * time.Second
+	}
+
+	if err := c.port.SetReadTimeout(timeout); err != nil {
+		return fmt.Errorf("SetReadTimeout: %w", err)
+	}
+
+	return nil
+}
+
+func (c *Conn) Write(d []byte) error {
+	begin := c.tracer.now()
+	args := c.traceFrameArgs(d)
+	frame := d
+
+	for len(d) > 0 {
+		n, err := c.port.Write(d)
+		c.txBytes += uint64(n)
+		if err != nil {
+			return fmt.Errorf("Write: %w", err)
+		}
+		d = d[n:]
+	}
+
+	c.recorder.written(frame)
+	c.lastWrite = c.tracer.now()
+	c.tracer.slice("write", "frame", begin, c.lastWrite, args)
+
+	return nil
+}
+
+// Drain discards what the device sent that was not read, e.g. replies
+// to a client that went away, until nothing arrives for quiet. It
+// returns the number of bytes discarded, and leaves reads without a
+// timeout.
+func (c *Conn) Drain(quiet time.Duration) (int, error) {
+	start := time.Now()
+	begin := c.tracer.now()
+	defer func() {
+		c.recorder.drained(start, quiet)
+		c.tracer.slice("drain", "frame", begin, c.tracer.now(), nil)
+	}()
+
+	if err := c.port.ResetInputBuffer(); err != nil {
+		return 0, fmt.Errorf("ResetInputBuffer: %w", err)
+	}
+	if err := c.port.SetReadTimeout(quiet); err != nil {
+		return 0, fmt.Errorf("SetReadTimeout: %w", err)
+	}
+
+	buf := make([]byte, 128)
+	total := 0
+	for {
+		n, err := c.port.Read(buf)
+		c.rxBytes += uint64(n)
+		total += n
+		if err != nil {
+			return total, fmt.Errorf("Read: %w", err)
+		}
+		if n == 0 {
+			break
+		}
+	}
+
+	return total, c.SetReadTimeout(0)
+}
+
+// readFull reads len(d) bytes, returning io.EOF if the read timeout
+// expires first.
+func (c *Conn) readFull(d []byte) error {
+	for len(d) > 0 {
+		n, err := c.port.Read(d)
+		c.rxBytes += uint64(n)
+		if err != nil {
+			return fmt.Errorf("Read: %w", err)
+		}
+		if n == 0 {
+			return io.EOF
+		}
+		d = d[n:]
+	}
+
+	return nil
+}
+
+// ReadFrame reads a reply to a command sent with id, which must be
+// the response expectedResp in a frame no longer than its length. The
+// returned buffer is always 1+expectedResp.CmdLen().Bytelen() bytes:
+// the frame header, then the frame, zero-padded.
+func (c *Conn) ReadFrame(expectedResp appCmd, expectedID int) ([]byte, tkeyclient.FramingHdr, error) {
+	rx := make([]byte, 1+expectedResp.CmdLen().Bytelen())
+
+	if err := c.readFull(rx[:1]); err != nil {
+		return nil, tkeyclient.FramingHdr{}, err
+	}
+	c.recorder.readStarted()
+	firstByte := c.tracer.now()
+	c.tracer.instant("first byte", "frame", firstByte)
+	c.tracer.slice("device", "device", c.lastWrite, firstByte, nil)
+
+	hdr, err := parseFrameHeader(rx[0])
+	if err != nil {
+		return nil, hdr, err
+	}
+
+	frameLen := hdr.CmdLen.Bytelen()
+	if hdr.CmdLen > expectedResp.CmdLen() {
+		return nil, hdr, fmt.Errorf("%w: frame of %d bytes, %s is at most %d bytes",
+			errOutOfStep, frameLen, expectedResp, expectedResp.CmdLen().Bytelen())
+	}
+	if err = c.readFull(rx[1 : 1+frameLen]); err != nil {
+		return nil, hdr, err
+	}
+	c.recorder.read(rx[:1+frameLen])
+	c.tracer.slice("read", "frame", firstByte, c.tracer.now(), c.traceFrameArgs(rx[:1+frameLen]))
+
+	if hdr.ResponseNotOK {
+		return nil, hdr, tkeyclient.ErrResponseStatusNotOK
+	}
+	if hdr.ID != byte(expectedID) {
+		return nil, hdr, fmt.Errorf("%w: frame ID %d, expected %d", errOutOfStep, hdr.ID, expectedID)
+	}
+	if hdr.Endpoint != expectedResp.Endpoint() {
+		return nil, hdr, fmt.Errorf("%w: frame for endpoint %d, expected %d", errOutOfStep, hdr.Endpoint, expectedResp.Endpoint())
+	}
+	if rx[1] != expectedResp.Code() {
+		return nil, hdr, fmt.Errorf("%w: response code 0x%02x, expected %s", errOutOfStep, rx[1], expectedResp)
+	}
+
+	return rx, hdr, nil
+}
+
+// traceFrameArgs describes the frame in d, header first, for the
+// tracer, if any.
+func (c *Conn) traceFrameArgs(d []byte) map[string]any {
+	if c.tracer == nil {
+		return nil
+	}
+
+	args := map[string]any{"bytes": len(d)}
+	if len(d) > 1 {
+		args["code"] = fmt.Sprintf("0x%02x", d[1])
+	}
+
+	return args
+}
+
+var (
+	// errOutOfStep is returned for a well-formed frame that is not the
+	// reply expected, e.g. a stale reply to an earlier command.
+	errOutOfStep = errors.New("reply out of step")
+
+	errFrameReserved = errors.New("reserved bit of frame header is set")
+)
+
+// parseFrameHeader decodes a frame header byte: reserved (bit 7),
+// ID (6-5), endpoint (4-3), response not OK (2) and length (1-0).
+func parseFrameHeader(b byte) (tkeyclient.FramingHdr, error) {
+	if b&0x80 != 0 {
+		return tkeyclient.FramingHdr{}, errFrameReserved
+	}
+
+	return tkeyclient.FramingHdr{
+		ID:            (b & 0x60) >> 5,
+		Endpoint:      tkeyclient.Endpoint((b & 0x18) >> 3),
+		ResponseNotOK: b&0x04 != 0,
+		CmdLen:        tkeyclient.CmdLen(b & 0x03),
+	}, nil
+}
@@ -0,0 +1,721 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// Portions Copyright (C) 2022, 2023 - Tillitis AB
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"encoding/base32"
+	"encoding/binary"
+	"fmt"
+	"time"
+
+	"github.com/tillitis/tkeyclient"
+)
+
+var (
+	cmdGetNameVersion = appCmd{0x01, "cmdGetNameVersion", tkeyclient.CmdLen1}
+	rspGetNameVersion = appCmd{0x02, "rspGetNameVersion", tkeyclient.CmdLen32}
+
+	cmdLoadToC = appCmd{0x03, "cmdLoadToC", tkeyclient.CmdLen128}
+	rspLoadToC = appCmd{0x04, "rspLoadToC", tkeyclient.CmdLen4}
+
+	cmdGetList = appCmd{0x05, "cmdGetList", tkeyclient.CmdLen1}
+	rspGetList = appCmd{0x06, "rspGetList", tkeyclient.CmdLen128}
+
+	cmdGetEncryptedToC = appCmd{0x07, "cmdGetEncryptedToC", tkeyclient.CmdLen1}
+	rspGetEncryptedToC = appCmd{0x08, "rspGetEncryptedToC", tkeyclient.CmdLen128}
+
+	cmdPut = appCmd{0x09, "cmdPut", tkeyclient.CmdLen128}
+	rspPut = appCmd{0x0a, "rspPut", tkeyclient.CmdLen4}
+
+	cmdPutGetRecord = appCmd{0x0b, "cmdPutGetRecord", tkeyclient.CmdLen1}
+	rspPutGetRecord = appCmd{0x0c, "rspPutGetRecord", tkeyclient.CmdLen128}
+
+	cmdCalculate = appCmd{0x0d, "cmdCalculate", tkeyclient.CmdLen128}
+	rspCalculate = appCmd{0x0e, "rspCalculate", tkeyclient.CmdLen128}
+
+	cmdMigrateGetKey = appCmd{0x0f, "cmdMigrateGetKey", tkeyclient.CmdLen1}
+	rspMigrateGetKey = appCmd{0x10, "rspMigrateGetKey", tkeyclient.CmdLen128}
+
+	cmdMigrateStart = appCmd{0x11, "cmdMigrateStart", tkeyclient.CmdLen128}
+	rspMigrateStart = appCmd{0x12, "rspMigrateStart", tkeyclient.CmdLen128}
+
+	cmdRewrap = appCmd{0x13, "cmdRewrap", tkeyclient.CmdLen128}
+	rspRewrap = appCmd{0x14, "rspRewrap", tkeyclient.CmdLen128}
+
+	cmdLookup = appCmd{0x15, "cmdLookup", tkeyclient.CmdLen128}
+	rspLookup = appCmd{0x16, "rspLookup", tkeyclient.CmdLen128}
+
+	cmdGetFilteredList = appCmd{0x17, "cmdGetFilteredList", tkeyclient.CmdLen128}
+	rspGetFilteredList = appCmd{0x18, "rspGetFilteredList", tkeyclient.CmdLen128}
+
+	cmdGetMemInfo = appCmd{0x19, "cmdGetMemInfo", tkeyclient.CmdLen1}
+	rspGetMemInfo = appCmd{0x1a, "rspGetMemInfo", tkeyclient.CmdLen32}
+
+	cmdReset = appCmd{0x1b, "cmdReset", tkeyclient.CmdLen1}
+	rspReset = appCmd{0x1c, "rspReset", tkeyclient.CmdLen32}
+)
+
+type appCmd struct {
+	code   byte
+	name   string
+	cmdLen tkeyclient.CmdLen
+}
+
+func (c appCmd) Code() byte {
+	return c.code
+}
+
+func (c appCmd) CmdLen() tkeyclient.CmdLen {
+	return c.cmdLen
+}
+
+func (c appCmd) Endpoint() tkeyclient.Endpoint {
+	return tkeyclient.DestApp
+}
+
+func (c appCmd) String() string {
+	return c.name
+}
+
+func MakePutRequestTOTP(secret string, name string, timestep int, needsTouch bool, digits int) []byte {
+	return makePutRecord(secret, name, timestep, true, needsTouch, digits)
+}
+
+func MakePutRequestHOTP(secret string, name string, counter int, needsTouch bool, digits int) []byte {
+	return makePutRecord(secret, name, counter, false, needsTouch, digits)
+}
+
+func makePutRecord(secret string, name string, timestepOrCounter int, isTimeBased bool, needsTouch bool, digits int) []byte {
+	var b32NoPadding = base32.StdEncoding.WithPadding(base32.NoPadding)
+	key, err := b32NoPadding.DecodeString(secret)
+	if err != nil {
+		le.Printf("makePutRecord error: %s\n", err)
+		return nil
+	}
+
+	properties := uint8(oathPropTypeHOTP)
+	if isTimeBased {
+		properties = oathPropTypeTOTP
+	}
+	if needsTouch {
+		properties |= oathPropTouchYes
+	}
+	protected := oathRecordProtected{
+		counterOrTimestep: uint64(timestepOrCounter),
+		properties:        properties,
+		digits:            uint8(digits),
+	}
+
+	oath_record_put_packed := make([]byte, oathRecordPutSize)
+	if err = encodeOathRecordPut(oath_record_put_packed, key, protected, []byte(name)); err != nil {
+		le.Printf("makePutRecord error: %s\n", err)
+		return nil
+	}
+
+	return oath_record_put_packed
+}
+
+func MakeCalculateRequest(record []byte) []byte {
+	return MakeCalculateRequestAt(record, time.Now())
+}
+
+// MakeCalculateRequestAt asks for the TOTP code valid at t, which may
+// be in the future.
+func MakeCalculateRequestAt(record []byte, t time.Time) []byte {
+	oath_calculate_packed := make([]byte, oathCalculateSize)
+	if err := encodeOathCalculate(oath_calculate_packed, record, uint32(t.Unix())); err != nil {
+		return nil
+	}
+
+	return oath_calculate_packed
+}
+
+type App struct {
+	conn *Conn // A connection to the app running on a TKey
+}
+
+// New allocates a struct for communicating with the oath app running
+// on the TKey. You're expected to pass an existing connection to it,
+// opened once the app runs, so use it like this:
+//
+//	conn, err := OpenConn(port, speed)
+//	deviceApp := New(conn)
+func New(conn *Conn) App {
+	var deviceApp App
+
+	deviceApp.conn = conn
+
+	return deviceApp
+}
+
+// Close closes the connection to the TKey
+func (p App) Close() error {
+	if err := p.conn.Close(); err != nil {
+		return fmt.Errorf("conn.Close: %w", err)
+	}
+	return nil
+}
+
+// WireBytes returns the number of bytes written to and read from the
+// TKey so far, frame headers included.
+func (p App) WireBytes() (uint64, uint64) {
+	return p.conn.txBytes, p.conn.rxBytes
+}
+
+// GetAppNameVersion gets the name and version of the running app in
+// the same style as the stick itself.
+func (p App) GetAppNameVersion() (*tkeyclient.NameVersion, error) {
+	defer p.conn.span("GetAppNameVersion")()
+
+	id := 2
+	tx, err := tkeyclient.NewFrameBuf(cmdGetNameVersion, id)
+	if err != nil {
+		return nil, fmt.Errorf("NewFrameBuf: %w", err)
+	}
+
+	tkeyclient.Dump("GetAppNameVersion tx", tx)
+	if err = p.conn.Write(tx); err != nil {
+		return nil, fmt.Errorf("Write: %w", err)
+	}
+
+	err = p.conn.SetReadTimeout(2)
+	if err != nil {
+		return nil, fmt.Errorf("SetReadTimeout: %w", err)
+	}
+
+	rx, _, err := p.conn.ReadFrame(rspGetNameVersion, id)
+	if err != nil {
+		return nil, fmt.Errorf("ReadFrame: %w", err)
+	}
+
+	err = p.conn.SetReadTimeout(0)
+	if err != nil {
+		return nil, fmt.Errorf("SetReadTimeout: %w", err)
+	}
+
+	nameVer := &tkeyclient.NameVersion{}
+	nameVer.Unpack(rx[2:])
+
+	return nameVer, nil
+}
+
+// LoadToC loads a sealed ToC. If the device is out of step, it is
+// resynced and the whole ToC sent again.
+func (p App) LoadToC(tocData []byte) error {
+	defer p.conn.span("LoadToC")()
+
+	return p.retryAfterResync("LoadToC", false, func() error {
+		return p.loadToC(tocData)
+	})
+}
+
+func (p App) loadToC(tocData []byte) error {
+	var offset int
+	var err error
+
+	var data []byte
+	if len(tocData) == 0 {
+		data = make([]byte, 1)
+		data[0] = 0
+	} else {
+		data = tocData
+	}
+
+	for nsent := 0; offset < len(data); offset += nsent {
+		nsent, err = p.sendChunk(cmdLoadToC, rspLoadToC, data[offset:])
+
+		if err != nil {
+			return fmt.Errorf("SetPattern: %w", err)
+		}
+	}
+	if offset > len(data) {
+		return fmt.Errorf("transmitted more than expected")
+	}
+
+	return nil
+}
+
+// PutRecord sends a new record, to be fetched sealed with
+// GetPutResult. If the device is out of step, it is resynced and the
+// whole record sent again.
+func (p App) PutRecord(data []byte) error {
+	defer p.conn.span("PutRecord")()
+
+	return p.retryAfterResync("PutRecord", true, func() error {
+		return p.putRecord(data)
+	})
+}
+
+func (p App) putRecord(data []byte) error {
+	var offset int
+	var err error
+
+	for nsent := 0; offset < len(data); offset += nsent {
+		nsent, err = p.sendChunk(cmdPut, rspPut, data[offset:])
+		if err != nil {
+			return fmt.Errorf("SetPattern: %w", err)
+		}
+	}
+	if offset > len(data) {
+		return fmt.Errorf("transmitted more than expected")
+	}
+
+	return nil
+}
+
+func (p App) sendChunk(cmd appCmd, rsp appCmd, content []byte) (int, error) {
+	id := 2
+	tx, err := tkeyclient.NewFrameBuf(cmd, id)
+	if err != nil {
+		return 0, fmt.Errorf("NewFrameBuf: %w", err)
+	}
+
+	payload := make([]byte, cmd.CmdLen().Bytelen()-1)
+	copied := copy(payload, content)
+
+	// Add padding if not filling the payload buffer.
+	if copied < len(payload) {
+		padding := make([]byte, len(payload)-copied)
+		copy(payload[copied:], padding)
+	}
+
+	copy(tx[2:], payload)
+
+	tkeyclient.Dump("sendChunk tx", tx)
+	if err = p.conn.Write(tx); err != nil {
+		return 0, fmt.Errorf("Write: %w", err)
+	}
+
+	// Wait for reply
+	rx, _, err := p.conn.ReadFrame(rsp, id)
+	if err != nil {
+		return 0, fmt.Errorf("ReadFrame: %w", err)
+	}
+
+	if rx[2] != tkeyclient.StatusOK {
+		return 0, fmt.Errorf("putSendChunk NOK")
+	}
+	return copied, nil
+}
+
+// GetPattern retrieves the LED pattern from the key.
+func (p App) GetPutResult(objectSize int) ([]byte, error) {
+	defer p.conn.span("GetPutResult")()
+
+	id := 2
+	payload := make([]byte, objectSize)
+
+	for nreceivedBytes := 0; nreceivedBytes < objectSize; {
+		tx, err := tkeyclient.NewFrameBuf(cmdPutGetRecord, id)
+		if err != nil {
+			return nil, fmt.Errorf("NewFrameBuf: %w", err)
+		}
+
+		tkeyclient.Dump("GetPattern tx", tx)
+		if err = p.conn.Write(tx); err != nil {
+			return nil, fmt.Errorf("Write: %w", err)
+		}
+
+		rx, _, err := p.conn.ReadFrame(rspPutGetRecord, id)
+		if err != nil {
+			return nil, fmt.Errorf("ReadFrame: %w", err)
+		}
+
+		if rx[2] != tkeyclient.StatusOK {
+			return nil, fmt.Errorf("getSig NOK")
+		}
+
+		nreceivedBytes += copy(payload[nreceivedBytes:], rx[3:])
+	}
+
+	return payload, nil
+}
+
+// GetEncryptedToC returns the ToC sealed again, with the records put
+// since it was loaded. If the device is out of step, it is resynced
+// and the transfer started over.
+func (p App) GetEncryptedToC() ([]byte, error) {
+	defer p.conn.span("GetEncryptedToC")()
+
+	var toc []byte
+	err := p.retryAfterResync("GetEncryptedToC", true, func() error {
+		var err error
+		toc, err = p.getEncryptedToC()
+		return err
+	})
+
+	return toc, err
+}
+
+func (p App) getEncryptedToC() ([]byte, error) {
+	id := 2
+	var payload []byte
+
+	objectSize := 1
+	for nreceivedBytes := 0; nreceivedBytes < objectSize; {
+		tx, err := tkeyclient.NewFrameBuf(cmdGetEncryptedToC, id)
+		if err != nil {
+			return nil, fmt.Errorf("NewFrameBuf: %w", err)
+		}
+
+		tkeyclient.Dump("GetPattern tx", tx)
+		if err = p.conn.Write(tx); err != nil {
+			return nil, fmt.Errorf("Write: %w", err)
+		}
+
+		rx, _, err := p.conn.ReadFrame(rspGetEncryptedToC, id)
+		if err != nil {
+			return nil, fmt.Errorf("ReadFrame: %w", err)
+		}
+
+		if rx[2] != tkeyclient.StatusOK {
+			return nil, fmt.Errorf("getSig NOK")
+		}
+
+		if nreceivedBytes == 0 {
+			objectSize = (int)(rx[3])
+			objectSize = sealedTocSize(objectSize)
+			if objectSize > decryptedTocSize {
+				return nil, fmt.Errorf("ToC of %d bytes is larger than %d", objectSize, decryptedTocSize)
+			}
+			payload = make([]byte, objectSize)
+		}
+
+		nreceivedBytes += copy(payload[nreceivedBytes:], rx[3:])
+	}
+
+	return payload, nil
+}
+
+// GetList returns the descriptors of the loaded ToC. If the device is
+// out of step, it is resynced and the transfer started over.
+func (p App) GetList() ([]byte, error) {
+	defer p.conn.span("GetList")()
+
+	var list []byte
+	err := p.retryAfterResync("GetList", true, func() error {
+		var err error
+		list, err = p.getList()
+		return err
+	})
+
+	return list, err
+}
+
+func (p App) getList() ([]byte, error) {
+	id := 2
+	var payload []byte
+
+	objectSize := 1
+	for nreceivedBytes := 0; nreceivedBytes < objectSize; {
+		tx, err := tkeyclient.NewFrameBuf(cmdGetList, id)
+		if err != nil {
+			return nil, fmt.Errorf("NewFrameBuf: %w", err)
+		}
+
+		tkeyclient.Dump("GetPattern tx", tx)
+		if err = p.conn.Write(tx); err != nil {
+			return nil, fmt.Errorf("Write: %w", err)
+		}
+
+		rx, _, err := p.conn.ReadFrame(rspGetList, id)
+		if err != nil {
+			return nil, fmt.Errorf("ReadFrame: %w", err)
+		}
+
+		if rx[2] == 0 {
+			return nil, nil
+		}
+
+		if nreceivedBytes == 0 {
+			objectSize = (int)(rx[2])
+			objectSize *= TocRecordDescriptorSize
+			payload = make([]byte, objectSize)
+		}
+
+		nreceivedBytes += copy(payload[nreceivedBytes:], rx[3:])
+	}
+
+	return payload, nil
+}
+
+// Calculate asks the device for the code of the record in request.
+// For a HOTP record the device also returns the record re-sealed with
+// the incremented counter, which the caller should persist.
+func (p App) Calculate(request []byte) (uint32, []byte, error) {
+	defer p.conn.span("Calculate")()
+
+	id := 2
+	tx, err := tkeyclient.NewFrameBuf(cmdCalculate, id)
+	if err != nil {
+		return 0, nil, fmt.Errorf("NewFrameBuf: %w", err)
+	}
+
+	payload := make([]byte, cmdCalculate.CmdLen().Bytelen()-1)
+	copied := copy(payload, request)
+
+	// Add padding if not filling the payload buffer.
+	if copied < len(payload) {
+		padding := make([]byte, len(payload)-copied)
+		copy(payload[copied:], padding)
+	}
+
+	copy(tx[2:], payload)
+
+	tkeyclient.Dump("Calculate tx", tx)
+	if err = p.conn.Write(tx); err != nil {
+		return 0, nil, fmt.Errorf("Write: %w", err)
+	}
+
+	rx, _, err := p.conn.ReadFrame(rspCalculate, id)
+	if err != nil {
+		return 0, nil, fmt.Errorf("ReadFrame: %w", err)
+	}
+
+	if rx[2] != tkeyclient.StatusOK {
+		return 0, nil, fmt.Errorf("getSig NOK")
+	}
+
+	code := uint32(rx[3]) | uint32(rx[4])<<8 | uint32(rx[5])<<16 | uint32(rx[6])<<24
+
+	var resealed []byte
+	if IsHOTPRecord(request) {
+		resealed = make([]byte, SecureOathRecordSize)
+		copy(resealed, rx[7:7+SecureOathRecordSize])
+	}
+
+	return code, resealed, nil
+}
+
+// IsHOTPRecord tells from the unencrypted metadata of a sealed record
+// (or of a calculate request, which starts with one) whether it is a
+// HOTP record.
+func IsHOTPRecord(record []byte) bool {
+	protected, ok := secureRecordProtected(record)
+
+	return ok && protected.properties&oathPropTypeHOTP != 0
+}
+
+// RecordDigits is the number of digits of the codes of a sealed
+// record.
+func RecordDigits(record []byte) int {
+	protected, _ := secureRecordProtected(record)
+
+	return int(protected.digits)
+}
+
+// RecordTimestep is the period in seconds of a sealed TOTP record.
+func RecordTimestep(record []byte) int {
+	protected, _ := secureRecordProtected(record)
+
+	return int(protected.counterOrTimestep)
+}
+
+// exchange sends one frame carrying payload and returns the reply
+// payload after the status byte, or an error if it is not OK.
+func (p App) exchange(cmd appCmd, rsp appCmd, payload []byte) ([]byte, error) {
+	id := 2
+	tx, err := tkeyclient.NewFrameBuf(cmd, id)
+	if err != nil {
+		return nil, fmt.Errorf("NewFrameBuf: %w", err)
+	}
+	if len(payload) > len(tx)-2 {
+		return nil, fmt.Errorf("%s: payload of %d bytes too large", cmd, len(payload))
+	}
+	copy(tx[2:], payload)
+
+	tkeyclient.Dump(cmd.String()+" tx", tx)
+	if err = p.conn.Write(tx); err != nil {
+		return nil, fmt.Errorf("Write: %w", err)
+	}
+
+	rx, _, err := p.conn.ReadFrame(rsp, id)
+	if err != nil {
+		return nil, fmt.Errorf("ReadFrame: %w", err)
+	}
+
+	if rx[2] != tkeyclient.StatusOK {
+		return nil, fmt.Errorf("%s NOK", cmd)
+	}
+
+	return rx[3:], nil
+}
+
+// GetMigrationKey returns the public key the running app accepts
+// migrated bundles for, and the digest of the app binary as it
+// measured it. Both only depend on the app binary and the TKey.
+func (p App) GetMigrationKey() (key []byte, digest []byte, err error) {
+	defer p.conn.span("GetMigrationKey")()
+
+	rx, err := p.exchange(cmdMigrateGetKey, rspMigrateGetKey, nil)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	key = append([]byte(nil), rx[:MigrateKeyLen]...)
+	digest = append([]byte(nil), rx[MigrateKeyLen:MigrateKeyLen+MigrateDigestLen]...)
+
+	return key, digest, nil
+}
+
+// StartMigration switches the device to re-wrapping. When exporting,
+// peerKey is the migration key of the target app and targetDigest
+// the digest of its binary, which the exported bundle only opens
+// in; the device asks for two touches and returns the ephemeral key
+// to store with the exported bundle. When importing, peerKey is that
+// ephemeral key, and targetDigest nil: the device uses its own.
+func (p App) StartMigration(mode byte, peerKey, targetDigest []byte) ([]byte, error) {
+	defer p.conn.span("StartMigration")()
+
+	if len(peerKey) != MigrateKeyLen {
+		return nil, fmt.Errorf("migration key is %d bytes, want %d", len(peerKey), MigrateKeyLen)
+	}
+	if (mode == MigrateModeExport) && (len(targetDigest) != MigrateDigestLen) {
+		return nil, fmt.Errorf("target app digest is %d bytes, want %d", len(targetDigest), MigrateDigestLen)
+	}
+
+	payload := append([]byte{mode}, peerKey...)
+	if mode == MigrateModeExport {
+		payload = append(payload, targetDigest...)
+	}
+	rx, err := p.exchange(cmdMigrateStart, rspMigrateStart, payload)
+	if err != nil {
+		return nil, err
+	}
+
+	return append([]byte(nil), rx[:MigrateKeyLen]...), nil
+}
+
+// Rewrap opens a sealed record with the migration's incoming key and
+// returns it sealed with its outgoing key.
+func (p App) Rewrap(record []byte) ([]byte, error) {
+	defer p.conn.span("Rewrap")()
+
+	if len(record) != SecureOathRecordSize {
+		return nil, fmt.Errorf("sealed record is %d bytes, want %d", len(record), SecureOathRecordSize)
+	}
+
+	rx, err := p.exchange(cmdRewrap, rspRewrap, record)
+	if err != nil {
+		return nil, err
+	}
+
+	return append([]byte(nil), rx[:SecureOathRecordSize]...), nil
+}
+
+// ListEntry is a record of the loaded ToC, as returned by ListNames.
+type ListEntry struct {
+	Slot int
+	Name string
+}
+
+func nameQuery(name string, prefix bool) ([]byte, error) {
+	if len(name) > RecordNameMaxLen {
+		return nil, fmt.Errorf("name too long: %d > %d bytes", len(name), RecordNameMaxLen)
+	}
+
+	var flags byte
+	if prefix {
+		flags |= indexQueryPrefix
+	}
+
+	return append([]byte{flags, byte(len(name))}, name...), nil
+}
+
+// Lookup returns the ToC slots of the records named name or, if
+// prefix is set, whose name starts with name, in name order.
+func (p App) Lookup(name string, prefix bool) ([]int, error) {
+	defer p.conn.span("Lookup")()
+
+	query, err := nameQuery(name, prefix)
+	if err != nil {
+		return nil, err
+	}
+
+	rx, err := p.exchange(cmdLookup, rspLookup, query)
+	if err != nil {
+		return nil, err
+	}
+
+	count := int(rx[0])
+	if count > TocDescriptorsMaxCount {
+		return nil, fmt.Errorf("lookup returned %d slots", count)
+	}
+	slots := make([]int, count)
+	for i := range slots {
+		slots[i] = int(rx[1+i])
+	}
+
+	return slots, nil
+}
+
+// ListNames returns the slot and name of the records whose name
+// starts with prefix, in name order. Only the matching names are
+// transferred, without padding.
+func (p App) ListNames(prefix string) ([]ListEntry, error) {
+	defer p.conn.span("ListNames")()
+
+	query, err := nameQuery(prefix, true)
+	if err != nil {
+		return nil, err
+	}
+
+	var entries []ListEntry
+	for {
+		rx, err := p.exchange(cmdGetFilteredList, rspGetFilteredList, query)
+		if err != nil {
+			return nil, err
+		}
+
+		n, left := int(rx[0]), int(rx[1])
+		off := 2
+		for i := 0; i < n; i++ {
+			if off+2 > len(rx) || off+2+int(rx[off+1]) > len(rx) {
+				return nil, fmt.Errorf("malformed filtered list frame")
+			}
+			nameLen := int(rx[off+1])
+			entries = append(entries, ListEntry{
+				Slot: int(rx[off]),
+				Name: string(rx[off+2 : off+2+nameLen]),
+			})
+			off += 2 + nameLen
+		}
+
+		if left == 0 {
+			return entries, nil
+		}
+		// continuation frames carry no query
+		query = nil
+	}
+}
+
+// MemInfo describes the RAM use of the device app.
+type MemInfo struct {
+	StackSize              uint32 `json:"stack_size"`
+	StackHighWater         uint32 `json:"stack_high_water"`
+	ArenaSize              uint32 `json:"arena_size"`
+	TocDescriptorsMaxCount int    `json:"toc_descriptors_maxcount"`
+	RecordNameMaxLen       int    `json:"record_name_maxlen"`
+}
+
+// GetMemInfo returns the stack size and the deepest the stack has
+// been since the app started, the size of the static arenas, and the
+// capacity profile the app was built with.
+func (p App) GetMemInfo() (*MemInfo, error) {
+	defer p.conn.span("GetMemInfo")()
+
+	rx, err := p.exchange(cmdGetMemInfo, rspGetMemInfo, nil)
+	if err != nil {
+		return nil, err
+	}
+
+	return &MemInfo{
+		StackSize:              binary.LittleEndian.Uint32(rx[0:]),
+		StackHighWater:         binary.LittleEndian.Uint32(rx[4:]),
+		ArenaSize:              binary.LittleEndian.Uint32(rx[8:]),
+		TocDescriptorsMaxCount: int(rx[12]),
+		RecordNameMaxLen:       int(rx[13]),
+	}, nil
+}
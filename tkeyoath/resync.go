@@ -0,0 +1,187 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"time"
+
+	"github.com/tillitis/tkeyclient"
+)
+
+// A client that goes away in the middle of a chunked transfer leaves
+// the device app expecting the rest of it, and answering NOK to
+// anything else; one that goes away in the middle of a frame leaves it
+// reading the next client's frames as the end of that one. Resync gets
+// both sides back in step without reloading the app.
+
+const (
+	// resyncFillerLen bytes of resyncFiller complete any frame the
+	// device is still reading. The rest are not valid frame headers,
+	// so the device discards them.
+	resyncFillerLen = 1 + 128
+	resyncFiller    = 0xff
+
+	// The device drops bytes until none arrived for this many byte
+	// times (DRAIN_IDLE_BYTE_TIMES in app/app_proto.c).
+	deviceDrainIdleByteTimes = 64
+
+	// resyncQuietByteTimes is how long, in byte times, the line must be
+	// quiet before the reset is sent. The filler may still be on its
+	// way when Write returns, and the device then waits
+	// deviceDrainIdleByteTimes for more: this covers both, twice over
+	// for the latter. resyncLinkLatency adds the USB round trip, which
+	// does not scale with the speed.
+	resyncQuietByteTimes = resyncFillerLen + 2*deviceDrainIdleByteTimes
+	resyncLinkLatency    = 5 * time.Millisecond
+
+	resyncAttempts = 2
+)
+
+// ErrOtherApp is returned by ResyncApp when the app running is not
+// the one expected.
+var ErrOtherApp = errors.New("tkeyoath: another app is running")
+
+// ResetState is what the device app reports when reset.
+type ResetState struct {
+	// ToCLoaded is false if the ToC is gone, e.g. because it was
+	// being loaded, and must be loaded again.
+	ToCLoaded bool
+	// Interrupted is the code of the command whose transfer was
+	// aborted, 0 if none was in progress.
+	Interrupted byte
+	// Dropped is the number of bytes the device discarded after
+	// frame headers it could not parse, since its last reset.
+	Dropped uint32
+}
+
+// Reset aborts the transfer in progress on the device, if any, and
+// wipes the partial record it may hold. A record being put is
+// forgotten, and a ToC being sent back is restored, so that the
+// transfer can be started over. A migration in progress is kept.
+func (p App) Reset() (ResetState, error) {
+	defer p.conn.span("Reset")()
+
+	if err := p.conn.SetReadTimeout(1); err != nil {
+		return ResetState{}, err
+	}
+	rx, err := p.exchange(cmdReset, rspReset, nil)
+	if terr := p.conn.SetReadTimeout(0); err == nil {
+		err = terr
+	}
+	if err != nil {
+		return ResetState{}, err
+	}
+
+	return ResetState{
+		ToCLoaded:   rx[0] != 0,
+		Interrupted: rx[1],
+		Dropped:     binary.LittleEndian.Uint32(rx[2:]),
+	}, nil
+}
+
+// Resync gets the device app and the connection back in step after
+// they fell out of it in this session: it completes any frame the
+// device is still reading, discards stale replies, then resets the
+// app.
+func (p App) Resync() (ResetState, error) {
+	defer p.conn.span("Resync")()
+
+	var err error
+	for attempt := 0; attempt < resyncAttempts; attempt++ {
+		if err = p.flush(); err != nil {
+			return ResetState{}, err
+		}
+
+		var state ResetState
+		if state, err = p.Reset(); err == nil {
+			return state, nil
+		}
+	}
+
+	return ResetState{}, fmt.Errorf("Reset: %w", err)
+}
+
+// ResyncApp is Resync on connecting to an app a previous client left
+// in an unknown state, which may not even be this app: once the line
+// is flushed, it asks for the app's name and version, and resets it
+// only if isApp accepts them, as RESET means something else, or
+// nothing, to other apps. It returns ErrOtherApp if isApp does not.
+func (p App) ResyncApp(isApp func(*tkeyclient.NameVersion) bool) (ResetState, error) {
+	defer p.conn.span("ResyncApp")()
+
+	var err error
+	for attempt := 0; attempt < resyncAttempts; attempt++ {
+		if err = p.flush(); err != nil {
+			return ResetState{}, err
+		}
+
+		var nameVer *tkeyclient.NameVersion
+		if nameVer, err = p.GetAppNameVersion(); err != nil {
+			err = fmt.Errorf("GetAppNameVersion: %w", err)
+			continue
+		}
+		if !isApp(nameVer) {
+			return ResetState{}, ErrOtherApp
+		}
+
+		var state ResetState
+		if state, err = p.Reset(); err == nil {
+			return state, nil
+		}
+		err = fmt.Errorf("Reset: %w", err)
+	}
+
+	return ResetState{}, err
+}
+
+// flush completes any frame the device is still reading with filler,
+// which it then discards, and drops what it sent that was not read.
+func (p App) flush() error {
+	filler := bytes.Repeat([]byte{resyncFiller}, resyncFillerLen)
+	if err := p.conn.Write(filler); err != nil {
+		return fmt.Errorf("Write: %w", err)
+	}
+	quiet := resyncQuietByteTimes*p.conn.byteTime() + resyncLinkLatency
+	if _, err := p.conn.Drain(quiet); err != nil {
+		return fmt.Errorf("Drain: %w", err)
+	}
+
+	return nil
+}
+
+// retryAfterResync runs op and, if it failed because the device was out
+// of step, resyncs and runs it once more. An op that needs the ToC is
+// not run again if the reset lost it.
+func (p App) retryAfterResync(name string, needsToC bool, op func() error) error {
+	err := op()
+	if err == nil || !isOutOfStep(err) {
+		return err
+	}
+
+	le.Printf("%s failed: %v, resyncing\n", name, err)
+	state, rerr := p.Resync()
+	if rerr != nil {
+		return fmt.Errorf("%w (resync failed: %v)", err, rerr)
+	}
+	if needsToC && !state.ToCLoaded {
+		return fmt.Errorf("%w (the device lost its ToC)", err)
+	}
+
+	return op()
+}
+
+// isOutOfStep tells errors caused by the device and the client
+// disagreeing on where they are in the protocol: no reply, or an
+// unexpected one, or a command refused outright.
+func isOutOfStep(err error) bool {
+	return errors.Is(err, io.EOF) ||
+		errors.Is(err, errOutOfStep) ||
+		errors.Is(err, errFrameReserved) ||
+		errors.Is(err, tkeyclient.ErrResponseStatusNotOK)
+}
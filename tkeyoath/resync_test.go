@@ -0,0 +1,65 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"errors"
+	"os"
+	"regexp"
+	"strconv"
+	"testing"
+
+	"github.com/tillitis/tkeyclient"
+)
+
+func TestResyncAppLeavesOtherAppsAlone(t *testing.T) {
+	port := newFakePort()
+	app := New(&Conn{port: port})
+
+	asked := 0
+	_, err := app.ResyncApp(func(*tkeyclient.NameVersion) bool {
+		asked++
+		return false
+	})
+	if !errors.Is(err, ErrOtherApp) {
+		t.Fatalf("ResyncApp: %v, want %v", err, ErrOtherApp)
+	}
+	if asked != 1 || port.deviceCalls(cmdGetNameVersion.Code()) != 1 {
+		t.Errorf("asked %d times for %d GET_NAMEVERSION, want 1", asked, port.deviceCalls(cmdGetNameVersion.Code()))
+	}
+	if n := port.deviceCalls(cmdReset.Code()); n != 0 {
+		t.Errorf("%d RESET sent to another app", n)
+	}
+}
+
+func TestResyncAppResetsThisApp(t *testing.T) {
+	port := newFakePort()
+	app := New(&Conn{port: port})
+
+	if _, err := app.ResyncApp(func(*tkeyclient.NameVersion) bool { return true }); err != nil {
+		t.Fatalf("ResyncApp: %v", err)
+	}
+	if port.deviceCalls(cmdGetNameVersion.Code()) != 1 || port.deviceCalls(cmdReset.Code()) != 1 {
+		t.Errorf("%d GET_NAMEVERSION and %d RESET, want 1 of each",
+			port.deviceCalls(cmdGetNameVersion.Code()), port.deviceCalls(cmdReset.Code()))
+	}
+}
+
+func TestResyncQuietCoversDeviceDrain(t *testing.T) {
+	src, err := os.ReadFile("../app/app_proto.c")
+	if err != nil {
+		t.Fatal(err)
+	}
+	m := regexp.MustCompile(`(?m)^#define DRAIN_IDLE_BYTE_TIMES (\d+)`).FindSubmatch(src)
+	if m == nil {
+		t.Fatal("no DRAIN_IDLE_BYTE_TIMES in app_proto.c")
+	}
+	if device, _ := strconv.Atoi(string(m[1])); device != deviceDrainIdleByteTimes {
+		t.Errorf("the device drains for %d byte times, deviceDrainIdleByteTimes is %d", device, deviceDrainIdleByteTimes)
+	}
+	if resyncQuietByteTimes < resyncFillerLen+deviceDrainIdleByteTimes {
+		t.Errorf("quiet for %d byte times, the filler and the drain take %d",
+			resyncQuietByteTimes, resyncFillerLen+deviceDrainIdleByteTimes)
+	}
+}
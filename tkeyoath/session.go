@@ -0,0 +1,264 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"sync"
+	"time"
+)
+
+// A session log holds the frames exchanged on a Conn with their
+// timing, to replay them later against another port, e.g. the QEMU
+// pty, and compare the latencies. After an 8-byte header (magic, then
+// version), each entry is:
+//
+//	kind       1 byte: SessionWrite, SessionRead or SessionDrain
+//	at         uvarint, µs since the previous entry's at: the end of a
+//	           write, the first byte of a read, or the start of a drain
+//	transfer   uvarint, µs from the first byte to the complete frame,
+//	           or from the start of the drain to its end (reads and
+//	           drains only)
+//	quiet      uvarint, µs the line had to be quiet to end the drain
+//	           (drains only)
+//	length     uvarint, bytes of the frame, header included (0 for a
+//	           drain)
+//	kept       uvarint, bytes of the frame stored: the trailing zero
+//	           padding of a frame is not
+//	data       kept bytes
+//
+// Frames written are logged as written, so a log can include bytes
+// that are not a well-formed frame, e.g. resync filler. The drain
+// after the filler is logged too, as the device discards what arrives
+// until the line is quiet: a replay must wait as long before the next
+// write.
+
+var sessionMagic = [8]byte{'t', 'k', 'o', 'a', 's', 'e', 's', 1}
+
+// SessionKind is the kind of a session log entry.
+type SessionKind byte
+
+const (
+	SessionWrite SessionKind = 'W' // a frame written to the device
+	SessionRead  SessionKind = 'R' // a frame read from the device
+	SessionDrain SessionKind = 'D' // unread bytes discarded until quiet
+)
+
+// SessionEntry is a frame of a session log, or a drain.
+type SessionEntry struct {
+	Kind SessionKind
+	// At is the time since the start of the session the write ended,
+	// the first byte of the frame read arrived, or the drain started.
+	At time.Duration
+	// Transfer is the time from the first byte of a frame read to its
+	// last, or from the start of a drain to its end.
+	Transfer time.Duration
+	// Quiet is how long the line had to be quiet to end a drain.
+	Quiet time.Duration
+	Data  []byte
+}
+
+// Recorder writes the frames exchanged on a Conn to a session log, as
+// they happen. A nil *Recorder records nothing.
+type Recorder struct {
+	mu        sync.Mutex
+	w         *bufio.Writer
+	dst       io.Writer
+	start     time.Time
+	last      time.Duration // at of the previous entry
+	firstByte time.Duration // of the frame being read
+	err       error
+}
+
+// NewRecorder starts a session log written to w.
+func NewRecorder(w io.Writer) *Recorder {
+	r := &Recorder{
+		w:     bufio.NewWriter(w),
+		dst:   w,
+		start: time.Now(),
+	}
+	r.w.Write(sessionMagic[:])
+
+	return r
+}
+
+// Close flushes the log and closes the writer it was created with, if
+// it is an io.Closer. It returns the first error met while writing.
+func (r *Recorder) Close() error {
+	if r == nil {
+		return nil
+	}
+
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	if err := r.w.Flush(); err != nil && r.err == nil {
+		r.err = err
+	}
+	if c, ok := r.dst.(io.Closer); ok {
+		if err := c.Close(); err != nil && r.err == nil {
+			r.err = err
+		}
+	}
+
+	return r.err
+}
+
+func (r *Recorder) written(d []byte) {
+	if r == nil {
+		return
+	}
+
+	r.entry(SessionWrite, time.Since(r.start), 0, 0, d)
+}
+
+func (r *Recorder) readStarted() {
+	if r == nil {
+		return
+	}
+
+	r.firstByte = time.Since(r.start)
+}
+
+func (r *Recorder) read(frame []byte) {
+	if r == nil {
+		return
+	}
+
+	r.entry(SessionRead, r.firstByte, time.Since(r.start)-r.firstByte, 0, frame)
+}
+
+// drained logs a drain that started at start.
+func (r *Recorder) drained(start time.Time, quiet time.Duration) {
+	if r == nil {
+		return
+	}
+
+	at := start.Sub(r.start)
+	r.entry(SessionDrain, at, time.Since(r.start)-at, quiet, nil)
+}
+
+func (r *Recorder) entry(kind SessionKind, at, transfer, quiet time.Duration, d []byte) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	kept := len(bytes.TrimRight(d, "\x00"))
+
+	// Deltas are rounded down, what is dropped counts for the next one
+	delta := (at - r.last) / time.Microsecond
+	r.last += delta * time.Microsecond
+
+	var buf [1 + 5*binary.MaxVarintLen64]byte
+	buf[0] = byte(kind)
+	n := 1
+	n += binary.PutUvarint(buf[n:], uint64(delta))
+	if kind != SessionWrite {
+		n += binary.PutUvarint(buf[n:], uint64(transfer/time.Microsecond))
+	}
+	if kind == SessionDrain {
+		n += binary.PutUvarint(buf[n:], uint64(quiet/time.Microsecond))
+	}
+	n += binary.PutUvarint(buf[n:], uint64(len(d)))
+	n += binary.PutUvarint(buf[n:], uint64(kept))
+	r.w.Write(buf[:n])
+	r.w.Write(d[:kept])
+}
+
+// ReadSessionLog reads a whole session log.
+func ReadSessionLog(rd io.Reader) ([]SessionEntry, error) {
+	r := bufio.NewReader(rd)
+
+	var magic [8]byte
+	if _, err := io.ReadFull(r, magic[:]); err != nil {
+		return nil, fmt.Errorf("reading header: %w", err)
+	}
+	if magic != sessionMagic {
+		return nil, fmt.Errorf("not a session log, or an unsupported version")
+	}
+
+	var entries []SessionEntry
+	var at time.Duration
+	for {
+		b, err := r.ReadByte()
+		if errors.Is(err, io.EOF) {
+			return entries, nil
+		}
+		if err != nil {
+			return nil, err
+		}
+		kind := SessionKind(b)
+		if kind != SessionWrite && kind != SessionRead && kind != SessionDrain {
+			return nil, fmt.Errorf("entry %d: unknown kind 0x%02x", len(entries), b)
+		}
+
+		var uerr error
+		uvarint := func() uint64 {
+			v, err := binary.ReadUvarint(r)
+			if uerr == nil {
+				uerr = err
+			}
+			return v
+		}
+		delta := uvarint()
+		var transfer, quiet uint64
+		if kind != SessionWrite {
+			transfer = uvarint()
+		}
+		if kind == SessionDrain {
+			quiet = uvarint()
+		}
+		length, kept := uvarint(), uvarint()
+		if uerr != nil {
+			return nil, fmt.Errorf("entry %d: %w", len(entries), uerr)
+		}
+		if kept > length || length > 1+128 {
+			return nil, fmt.Errorf("entry %d: %d bytes of a %d-byte frame", len(entries), kept, length)
+		}
+
+		data := make([]byte, length)
+		if _, err = io.ReadFull(r, data[:kept]); err != nil {
+			return nil, fmt.Errorf("entry %d: %w", len(entries), err)
+		}
+
+		at += time.Duration(delta) * time.Microsecond
+		entries = append(entries, SessionEntry{
+			Kind:     kind,
+			At:       at,
+			Transfer: time.Duration(transfer) * time.Microsecond,
+			Quiet:    time.Duration(quiet) * time.Microsecond,
+			Data:     data,
+		})
+	}
+}
+
+// ReadRawFrame reads a frame of any kind, and returns it with its
+// header, and the time its first byte arrived.
+func (c *Conn) ReadRawFrame() ([]byte, time.Time, error) {
+	rx := make([]byte, 1+128)
+
+	if err := c.readFull(rx[:1]); err != nil {
+		return nil, time.Time{}, err
+	}
+	firstByte := time.Now()
+	c.recorder.readStarted()
+
+	hdr, err := parseFrameHeader(rx[0])
+	if err != nil {
+		return nil, firstByte, err
+	}
+
+	frameLen := hdr.CmdLen.Bytelen()
+	if err = c.readFull(rx[1 : 1+frameLen]); err != nil {
+		return nil, firstByte, err
+	}
+
+	c.recorder.read(rx[:1+frameLen])
+
+	return rx[:1+frameLen], firstByte, nil
+}
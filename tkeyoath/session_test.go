@@ -0,0 +1,53 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"bytes"
+	"testing"
+)
+
+func TestSessionLogsResyncDrain(t *testing.T) {
+	var log bytes.Buffer
+	conn := &Conn{port: newFakePort()}
+	recorder := NewRecorder(&log)
+	conn.SetRecorder(recorder)
+
+	if _, err := New(conn).Resync(); err != nil {
+		t.Fatalf("Resync: %v", err)
+	}
+	if err := recorder.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	entries, err := ReadSessionLog(&log)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// The filler, waiting for quiet, then the reset and its reply
+	want := []SessionKind{SessionWrite, SessionDrain, SessionWrite, SessionRead}
+	if len(entries) != len(want) {
+		t.Fatalf("%d entries, want %d", len(entries), len(want))
+	}
+	for i, e := range entries {
+		if e.Kind != want[i] {
+			t.Errorf("entry %d is %c, want %c", i, e.Kind, want[i])
+		}
+	}
+
+	drain := entries[1]
+	quiet := resyncQuietByteTimes*conn.byteTime() + resyncLinkLatency
+	if drain.Quiet != quiet.Truncate(1000) || len(drain.Data) != 0 {
+		t.Errorf("drain quiet %v with %d bytes, want %v and none", drain.Quiet, len(drain.Data), quiet)
+	}
+	// The drain lasts at least the quiet time, and the reset is only
+	// written after it
+	if drain.Transfer < drain.Quiet || entries[2].At < drain.At+drain.Transfer {
+		t.Errorf("drain at %v for %v, reset written at %v", drain.At, drain.Transfer, entries[2].At)
+	}
+	if !bytes.Equal(entries[0].Data, bytes.Repeat([]byte{resyncFiller}, resyncFillerLen)) {
+		t.Errorf("first entry %x is not the filler", entries[0].Data)
+	}
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Writes the packed C layout of every struct of app/definitions.h,
+// filled with the inputs codec_test.go encodes, as JSON. Built for
+// the host, once per capacity profile, by make golden.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../app/definitions.h"
+
+static const uint8_t key[] = {0x00, 0x08, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x21,
+			      0xde, 0xad, 0xbe, 0xef, 0x01, 0x02, 0x03, 0x04,
+			      0x05, 0x06, 0x07, 0x08, 0x09, 0x0a};
+static const char name[] = "alice@example.com";
+static const uint64_t counter = 0x0102030405060708ULL;
+static const uint8_t properties = OATH_PROP_TYPE_HOTP | OATH_PROP_TOUCH_YES;
+static const uint8_t digits = 8;
+static const uint32_t calc_time = 0x5f5e1000;
+
+static void fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = (uint8_t)(seed + i * 7);
+	}
+}
+
+static void field(const char *name, const void *buf, size_t len, int last)
+{
+	const uint8_t *b = buf;
+
+	printf("    \"%s\": \"", name);
+	for (size_t i = 0; i < len; i++) {
+		printf("%02x", b[i]);
+	}
+	printf("\"%s\n", last ? "" : ",");
+}
+
+int main(void)
+{
+	oath_record_secret_t secret;
+	oath_record_protected_t protected;
+	oath_record_put_t put;
+	secure_oath_record_t secure;
+	oath_calculate_t calculate;
+	toc_record_descriptor_t descriptor;
+	toc_header_protected_t toc_protected;
+	decrypted_toc_header_t toc_header;
+
+	memset(&secret, 0, sizeof(secret));
+	secret.key_len = sizeof(key);
+	memcpy(secret.key, key, sizeof(key));
+
+	memset(&protected, 0, sizeof(protected));
+	protected.counter_or_timestep = counter;
+	protected.properties = properties;
+	protected.digits = digits;
+
+	memset(&put, 0, sizeof(put));
+	memcpy(put.record.encrypted_blob, &secret, sizeof(secret));
+	put.record.protected = protected;
+	put.name_len = strlen(name);
+	memcpy(put.name, name, strlen(name));
+
+	fill((uint8_t *)&secure, sizeof(secure), 0x11);
+	secure.record.protected = protected;
+
+	calculate.secure_record = secure;
+	calculate.time = calc_time;
+
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.name_len = strlen(name);
+	memcpy(descriptor.name, name, strlen(name));
+
+	toc_protected.settings = TOC_SETTING_TOUCH_YES;
+
+	toc_header.descriptor_count = 3;
+	fill(toc_header.nonce, sizeof(toc_header.nonce), 0x21);
+	fill(toc_header.mac, sizeof(toc_header.mac), 0x31);
+	toc_header.protected_header = toc_protected;
+
+	printf("{\n");
+	printf("  \"toc_descriptors_maxcount\": %d,\n", TOC_DESCRIPTORS_MAXCOUNT);
+	printf("  \"record_name_maxlen\": %d,\n", RECORD_NAME_MAXLEN);
+	printf("  \"sizes\": {\n");
+	printf("    \"oath_record_secret\": %zu,\n", sizeof(oath_record_secret_t));
+	printf("    \"oath_record_protected\": %zu,\n", sizeof(oath_record_protected_t));
+	printf("    \"oath_record\": %zu,\n", sizeof(oath_record_t));
+	printf("    \"secure_oath_record\": %zu,\n", sizeof(secure_oath_record_t));
+	printf("    \"oath_record_put\": %zu,\n", sizeof(oath_record_put_t));
+	printf("    \"oath_calculate\": %zu,\n", sizeof(oath_calculate_t));
+	printf("    \"toc_record_descriptor\": %zu,\n", sizeof(toc_record_descriptor_t));
+	printf("    \"toc_header_protected\": %zu,\n", sizeof(toc_header_protected_t));
+	printf("    \"decrypted_toc_header\": %zu,\n", sizeof(decrypted_toc_header_t));
+	printf("    \"decrypted_toc\": %zu\n", sizeof(decrypted_toc_t));
+	printf("  },\n");
+	printf("  \"vectors\": {\n");
+	field("oath_record_secret", &secret, sizeof(secret), 0);
+	field("oath_record_protected", &protected, sizeof(protected), 0);
+	field("oath_record_put", &put, sizeof(put), 0);
+	field("secure_oath_record", &secure, sizeof(secure), 0);
+	field("oath_calculate", &calculate, sizeof(calculate), 0);
+	field("toc_record_descriptor", &descriptor, sizeof(descriptor), 0);
+	field("toc_header_protected", &toc_protected, sizeof(toc_protected), 0);
+	field("decrypted_toc_header", &toc_header, sizeof(toc_header), 1);
+	printf("  }\n");
+	printf("}\n");
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+// Copyright (C) 2023 - Perceval Faramaz
+// SPDX-License-Identifier: GPL-2.0-only
+
+package tkeyoath
+
+import (
+	"bufio"
+	"encoding/json"
+	"fmt"
+	"io"
+	"sync"
+	"time"
+)
+
+// Tracer writes the timing of every frame exchanged on a Conn, grouped
+// under a span per App operation, in the Chrome trace event format
+// (JSON array form), which chrome://tracing and ui.perfetto.dev open.
+//
+// Every frame written is a "write" slice, the wait from the end of a
+// write to the first byte of the reply a "device" slice, and reading
+// the reply from its first byte a "read" slice, with an instant event
+// at the first byte. Discarding unread bytes until the line is quiet,
+// when resyncing, is a "drain" slice. Timestamps are in microseconds from the creation
+// of the Tracer, on the monotonic clock.
+//
+// A nil *Tracer records nothing.
+type Tracer struct {
+	mu    sync.Mutex
+	w     *bufio.Writer
+	dst   io.Writer
+	start time.Time
+	n     int // events written
+	err   error
+}
+
+type traceEvent struct {
+	Name string         `json:"name"`
+	Cat  string         `json:"cat,omitempty"`
+	Ph   string         `json:"ph"`
+	Ts   float64        `json:"ts"`
+	Dur  *float64       `json:"dur,omitempty"`
+	S    string         `json:"s,omitempty"`
+	Pid  int            `json:"pid"`
+	Tid  int            `json:"tid"`
+	Args map[string]any `json:"args,omitempty"`
+}
+
+// NewTracer starts a trace written to w as it is recorded, so that a
+// long session does not accumulate it in memory.
+func NewTracer(w io.Writer) *Tracer {
+	t := &Tracer{
+		w:     bufio.NewWriter(w),
+		dst:   w,
+		start: time.Now(),
+	}
+	t.w.WriteString("[\n")
+	t.emit(traceEvent{
+		Name: "process_name",
+		Ph:   "M",
+		Args: map[string]any{"name": "tkeyoath"},
+	})
+
+	return t
+}
+
+// Close ends the trace and closes the writer it was created with, if
+// it is an io.Closer. It returns the first error met while writing.
+func (t *Tracer) Close() error {
+	if t == nil {
+		return nil
+	}
+
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	t.w.WriteString("\n]\n")
+	if err := t.w.Flush(); err != nil && t.err == nil {
+		t.err = err
+	}
+	if c, ok := t.dst.(io.Closer); ok {
+		if err := c.Close(); err != nil && t.err == nil {
+			t.err = err
+		}
+	}
+
+	return t.err
+}
+
+// now is the time since the trace started. It is 0 for a nil Tracer.
+func (t *Tracer) now() time.Duration {
+	if t == nil {
+		return 0
+	}
+
+	return time.Since(t.start)
+}
+
+// Span starts a span named name, and returns the function ending it.
+func (t *Tracer) Span(name string) func() {
+	if t == nil {
+		return func() {}
+	}
+
+	begin := t.now()
+	return func() {
+		t.slice(name, "op", begin, t.now(), nil)
+	}
+}
+
+// slice records an event lasting from begin to end.
+func (t *Tracer) slice(name, cat string, begin, end time.Duration, args map[string]any) {
+	if t == nil {
+		return
+	}
+
+	dur := micros(end - begin)
+	t.emit(traceEvent{
+		Name: name,
+		Cat:  cat,
+		Ph:   "X",
+		Ts:   micros(begin),
+		Dur:  &dur,
+		Args: args,
+	})
+}
+
+// instant records an event without duration at at.
+func (t *Tracer) instant(name, cat string, at time.Duration) {
+	if t == nil {
+		return
+	}
+
+	t.emit(traceEvent{
+		Name: name,
+		Cat:  cat,
+		Ph:   "i",
+		Ts:   micros(at),
+		S:    "t",
+	})
+}
+
+func (t *Tracer) emit(ev traceEvent) {
+	ev.Pid, ev.Tid = 1, 1
+	b, err := json.Marshal(ev)
+
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	if err != nil {
+		if t.err == nil {
+			t.err = fmt.Errorf("trace: %w", err)
+		}
+		return
+	}
+	if t.n > 0 {
+		t.w.WriteString(",\n")
+	}
+	t.w.Write(b)
+	t.n++
+}
+
+func micros(d time.Duration) float64 {
+	return float64(d) / float64(time.Microsecond)
+}